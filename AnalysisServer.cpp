@@ -0,0 +1,299 @@
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include "AnalysisServer.h"
+#include "Chess.h"
+#include "MateSolver.h"
+#include "SearchContext.h"
+#include "SearchStats.h"
+#include "Socket.h"
+#include "Utils.h"
+
+// Size of the table each worker keeps for node-limited requests
+constexpr size_t private_table_megabytes = 16;
+
+class Connection;
+
+class AnalysisJob {
+public:
+  string id;
+  string fen;
+  Variant variant = VARIANT_NONE;
+  bool solve_mate = false;
+  SearchLimits limits;
+  MateLimits mate_limits;
+  atomic<bool> cancelled{ false };
+  shared_ptr<Connection> connection;
+};
+
+class Connection {
+public:
+  // Writes whole lines, so replies from different workers don't interleave
+  void send(const string& line);
+  bool add_job(const shared_ptr<AnalysisJob>& job);
+  void remove_job(const string& id);
+  void cancel_job(const string& id);
+  void cancel_all();
+  Socket socket;
+private:
+  mutex write_mutex;
+  mutex jobs_mutex;
+  unordered_map<string, shared_ptr<AnalysisJob>> jobs;
+};
+
+void Connection::send(const string& line)
+{
+  lock_guard<mutex> lock(write_mutex);
+  socket.send_all(line + "\n");
+}
+
+bool Connection::add_job(const shared_ptr<AnalysisJob>& job)
+{
+  lock_guard<mutex> lock(jobs_mutex);
+  return jobs.emplace(job->id, job).second;
+}
+
+void Connection::remove_job(const string& id)
+{
+  lock_guard<mutex> lock(jobs_mutex);
+  jobs.erase(id);
+}
+
+void Connection::cancel_job(const string& id)
+{
+  lock_guard<mutex> lock(jobs_mutex);
+  auto job = jobs.find(id);
+  if (job != jobs.end())
+    job->second->cancelled = true;
+}
+
+void Connection::cancel_all()
+{
+  lock_guard<mutex> lock(jobs_mutex);
+  for (auto& job : jobs)
+    job.second->cancelled = true;
+}
+
+class JobQueue {
+public:
+  void push(shared_ptr<AnalysisJob> job);
+  shared_ptr<AnalysisJob> pop();
+private:
+  mutex queue_mutex;
+  condition_variable ready;
+  deque<shared_ptr<AnalysisJob>> jobs;
+};
+
+void JobQueue::push(shared_ptr<AnalysisJob> job)
+{
+  {
+    lock_guard<mutex> lock(queue_mutex);
+    jobs.push_back(move(job));
+  }
+  ready.notify_one();
+}
+
+shared_ptr<AnalysisJob> JobQueue::pop()
+{
+  unique_lock<mutex> lock(queue_mutex);
+  ready.wait(lock, [this] { return !jobs.empty(); });
+  shared_ptr<AnalysisJob> job = move(jobs.front());
+  jobs.pop_front();
+  return job;
+}
+
+static string run_mate_job(AnalysisJob& job, const BoardState& root)
+{
+  job.mate_limits.stop = &job.cancelled;
+  const MateResult result = solve_mate(root, job.mate_limits);
+  static const char* status_names[] = { "unknown", "win", "nowin" };
+  ostringstream reply;
+  reply << "solution " << job.id << " " << status_names[result.status] <<
+    " nodes " << result.nodes;
+  if (result.status == MATE_PROVEN) {
+    reply << " pv";
+    for (const string& move : result.line)
+      reply << " " << move;
+  }
+  return reply.str();
+}
+
+// Searches the request, streaming its progress, and returns the line that
+// ends it
+static string run_job(AnalysisJob& job, SearchContext& context)
+{
+  Connection& connection = *job.connection;
+  set_variant(job.variant);
+  BoardState root;
+  if (!root.load_fen(job.fen))
+    return "error " + job.id + " invalid fen";
+  if (root.possible_moves.empty())
+    return "error " + job.id + " no legal moves";
+  if (job.solve_mate)
+    return run_mate_job(job, root);
+
+  Timer timer;
+  context.limits = job.limits;
+  context.limits.stop = &job.cancelled;
+  context.limits.on_iteration = [&](const IterationStats& it) {
+    for (size_t i = 0; i < it.lines.size(); i++) {
+      ostringstream info;
+      info << "info " << job.id << " depth " << it.depth << " multipv " << i + 1 <<
+        " score " << it.lines[i].score << " nodes " << it.nodes <<
+        " time " << static_cast<int>(timer.elapsed() * 1000) << " pv";
+      for (const string& move : it.lines[i].moves)
+        info << " " << move;
+      connection.send(info.str());
+    }
+  };
+
+  int score;
+  const Move* best_move = root.search(context, score);
+  const SearchStats& stats = context.stats;
+  if (stats.iterations.empty())
+    return "bestmove " + job.id + " none";
+  string str;
+  move_to_string(&root, best_move, str);
+  ostringstream reply;
+  reply << "bestmove " << job.id << " " << str << " score " << score <<
+    " depth " << stats.iterations.size() << " nodes " << context.nodes;
+  return reply.str();
+}
+
+static void run_worker(JobQueue& queue, TranspositionTable& table)
+{
+  SearchContext context(table);
+  // Node-limited requests search a table of their own, cleared first, so
+  // their results depend on nothing but the position and the limits
+  unique_ptr<TranspositionTable> private_table;
+  unique_ptr<SearchContext> private_context;
+  while (true) {
+    shared_ptr<AnalysisJob> job = queue.pop();
+    string reply;
+    if (job->limits.nodes && !job->solve_mate) {
+      if (!private_table) {
+        private_table.reset(new TranspositionTable(private_table_megabytes));
+        private_context.reset(new SearchContext(*private_table));
+      }
+      private_table->clear();
+      reply = run_job(*job, *private_context);
+    } else {
+      reply = run_job(*job, context);
+    }
+    // The id is free again as soon as the client can see the answer
+    job->connection->remove_job(job->id);
+    job->connection->send(reply);
+  }
+}
+
+static bool parse_variant(const string& name, Variant& variant)
+{
+  if (name == "none" || name == "standard")
+    variant = VARIANT_NONE;
+  else if (name == "atomic")
+    variant = VARIANT_ATOMIC;
+  else if (name == "hill")
+    variant = VARIANT_HILL;
+  else
+    return false;
+  return true;
+}
+
+// Fills in a job from the words after "analyse <id>" or "mate <id>", or
+// returns why not
+static string parse_request(istringstream& in, AnalysisJob& job)
+{
+  string word;
+  bool timed = false;
+  while (in >> word) {
+    if (word == "fen") {
+      getline(in >> ws, job.fen);
+      // A depth or node limit on its own makes the search reproducible,
+      // which the default time limit would spoil
+      if (!timed && (job.limits.depth || job.limits.nodes))
+        job.limits.seconds = numeric_limits<double>::infinity();
+      return job.fen.empty() ? "missing fen" : "";
+    }
+    string value;
+    if (!(in >> value))
+      return "missing value for " + word;
+    if (word == "variant") {
+      if (!parse_variant(value, job.variant))
+        return "unknown variant " + value;
+    } else if (word == "depth") {
+      job.limits.depth = max(0, atoi(value.c_str()));
+    } else if (word == "movetime") {
+      job.limits.seconds = atoi(value.c_str()) / 1000.0;
+      timed = true;
+    } else if (word == "multipv") {
+      job.limits.multi_pv = max(1, atoi(value.c_str()));
+    } else if (word == "nodes") {
+      job.limits.nodes = max(1LL, atoll(value.c_str()));
+      job.mate_limits.max_nodes = job.limits.nodes;
+    } else {
+      return "unknown parameter " + word;
+    }
+  }
+  return "missing fen";
+}
+
+static void serve_connection(shared_ptr<Connection> connection, JobQueue& queue)
+{
+  string line;
+  while (connection->socket.read_line(line)) {
+    istringstream in(line);
+    string command, id;
+    in >> command >> id;
+    if ((command == "analyse" || command == "mate") && !id.empty()) {
+      shared_ptr<AnalysisJob> job = make_shared<AnalysisJob>();
+      job->id = id;
+      job->solve_mate = command == "mate";
+      job->connection = connection;
+      const string problem = parse_request(in, *job);
+      if (!problem.empty())
+        connection->send("error " + id + " " + problem);
+      else if (!connection->add_job(job))
+        connection->send("error " + id + " id already in use");
+      else
+        queue.push(job);
+    } else if (command == "stop" && !id.empty()) {
+      connection->cancel_job(id);
+    } else if (command == "quit") {
+      break;
+    } else if (!command.empty()) {
+      connection->send("error - unknown command " + command);
+    }
+  }
+  // Nobody is left to read the results
+  connection->cancel_all();
+  connection->socket.shutdown();
+}
+
+int run_analysis_server(int port, int num_workers, TranspositionTable& table)
+{
+  Socket listener;
+  if (!listener.listen(port)) {
+    cout << "Failed to listen on port " << port << "\n";
+    return 1;
+  }
+  cout << "Analysis server listening on 127.0.0.1:" << port << " with " <<
+    num_workers << " workers" << endl;
+
+  JobQueue queue;
+  vector<thread> workers;
+  for (int i = 0; i < num_workers; i++)
+    workers.emplace_back(run_worker, ref(queue), ref(table));
+
+  while (true) {
+    shared_ptr<Connection> connection = make_shared<Connection>();
+    if (listener.accept(connection->socket))
+      thread(serve_connection, connection, ref(queue)).detach();
+  }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "TranspositionTable.h"
+
+// An in-process analysis service on 127.0.0.1, speaking lines of text:
+//
+//   analyse <id> [variant atomic|hill] [depth <n>] [nodes <n>]
+//           [movetime <ms>] [multipv <n>] fen <fen>
+//   mate <id> [variant atomic|hill] [nodes <n>] fen <fen>
+//   stop <id>
+//   quit
+//
+// Requests from any number of connections are queued for a fixed pool of
+// workers. Each has a search context of its own, and all of them share one
+// transposition table (sized with Hash=). A position's hash depends on the
+// variant, so requests in different variants never answer each other from
+// it. While a request is searched the server streams
+//
+//   info <id> depth <d> multipv <k> score <cp> nodes <n> time <ms> pv <moves>
+//
+// after each iteration, and always finishes it with
+//
+//   bestmove <id> <move>|none [score <cp> depth <d> nodes <n>]
+//
+// or error <id> <reason>. A stopped request, or one whose connection
+// closes, ends with the best move of its last completed iteration.
+//
+// A mate request runs the proof-number solver instead and answers once,
+// with
+//
+//   solution <id> win|nowin|unknown nodes <n> [pv <moves>]
+//
+// where unknown means the node budget ran out or the request was stopped.
+//
+// An analyse request stops at the first limit it reaches. Without a
+// movetime, depth and nodes are the only limits. A node-limited request is
+// searched on a cleared table of the worker's own, so the same request
+// always gets the same answer, however many others are running.
+
+// Serves forever, or returns nonzero if the port can't be opened
+int run_analysis_server(int port, int num_workers, TranspositionTable& table);
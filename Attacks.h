@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+using namespace std;
+
+// Attack and ray bitboards, generated at compile time. Squares are numbered
+// y * 8 + x from a1.
+
+enum Direction {
+  DIR_EAST,
+  DIR_WEST,
+  DIR_NORTH,
+  DIR_SOUTH,
+  DIR_NORTH_EAST,
+  DIR_SOUTH_EAST,
+  DIR_NORTH_WEST,
+  DIR_SOUTH_WEST,
+  NUM_DIRECTIONS,
+};
+
+// Rook directions come first, then bishop directions
+constexpr int direction_offsets[NUM_DIRECTIONS][2] = {
+  { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 },
+  { 1, 1 }, { 1, -1 }, { -1, 1 }, { -1, -1 },
+};
+
+class AttackTables {
+public:
+  uint64_t knight[64];
+  uint64_t king[64];
+  // Squares a pawn of each colour (indexed by PieceColour) on a square attacks
+  uint64_t pawn[2][64];
+  // Squares from a square outwards to the edge, not including the square
+  uint64_t rays[NUM_DIRECTIONS][64];
+  // A square and its neighbours: everything a capture there blows up in atomic
+  uint64_t explosion[64];
+  // King moves from a square to the nearest of the four centre squares
+  int hill_distance[64];
+};
+
+constexpr uint64_t square_bit(int x, int y)
+{
+  return x >= 0 && x < 8 && y >= 0 && y < 8 ? 1ULL << (y * 8 + x) : 0;
+}
+
+// d4, e4, d5 and e5: a king reaching any of them wins King of the Hill
+constexpr uint64_t hill_mask = 0x0000001818000000ULL;
+
+constexpr AttackTables make_attack_tables()
+{
+  AttackTables tables{};
+  for (int square = 0; square < 64; square++) {
+    const int x = square % 8, y = square / 8;
+    for (int d2 = -2; d2 <= 2; d2 += 4) {
+      for (int d1 = -1; d1 <= 1; d1 += 2)
+        tables.knight[square] |= square_bit(x + d2, y + d1) | square_bit(x + d1, y + d2);
+    }
+    for (int i = -1; i <= 1; i++) {
+      for (int j = -1; j <= 1; j++) {
+        if (i || j)
+          tables.king[square] |= square_bit(x + i, y + j);
+      }
+    }
+    tables.explosion[square] = tables.king[square] | square_bit(x, y);
+    const int hill_dx = x < 3 ? 3 - x : x > 4 ? x - 4 : 0;
+    const int hill_dy = y < 3 ? 3 - y : y > 4 ? y - 4 : 0;
+    tables.hill_distance[square] = hill_dx > hill_dy ? hill_dx : hill_dy;
+    tables.pawn[0][square] = square_bit(x - 1, y - 1) | square_bit(x + 1, y - 1);
+    tables.pawn[1][square] = square_bit(x - 1, y + 1) | square_bit(x + 1, y + 1);
+    for (int d = 0; d < NUM_DIRECTIONS; d++) {
+      for (int i = x + direction_offsets[d][0], j = y + direction_offsets[d][1];
+           i >= 0 && i < 8 && j >= 0 && j < 8;
+           i += direction_offsets[d][0], j += direction_offsets[d][1]) {
+        tables.rays[d][square] |= square_bit(i, j);
+      }
+    }
+  }
+  return tables;
+}
+
+constexpr AttackTables attack_tables = make_attack_tables();
+
+// Index of the lowest set bit, which must exist, and clears it
+inline int pop_lowest_square(uint64_t& bits)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+  unsigned long square;
+  _BitScanForward64(&square, bits);
+#elif defined(_MSC_VER)
+  unsigned long square;
+  if (!_BitScanForward(&square, static_cast<unsigned long>(bits))) {
+    _BitScanForward(&square, static_cast<unsigned long>(bits >> 32));
+    square += 32;
+  }
+#else
+  const int square = __builtin_ctzll(bits);
+#endif
+  bits &= bits - 1;
+  return static_cast<int>(square);
+}
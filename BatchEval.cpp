@@ -0,0 +1,195 @@
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "Attacks.h"
+#include "BatchEval.h"
+#include "PawnHashTable.h"
+#include "PieceSquareTables.h"
+#include "Zobrist.h"
+
+// Material and piece-square value of every set of pieces that can share a
+// rank, by piece, rank and the rank's byte of the bitboard, from white's
+// side of the board. Black's rank y reads white's rank 7 - y.
+class RankTables {
+public:
+  RankTables();
+  int32_t values[KING][8][256];
+};
+
+RankTables::RankTables()
+{
+  static const int* const tables[] = { pawn_pst, knight_pst, bishop_pst, rook_pst, queen_pst };
+  for (int piece = PAWN; piece < KING; piece++) {
+    for (int y = 0; y < 8; y++) {
+      for (int byte = 0; byte < 256; byte++) {
+        int32_t value = 0;
+        for (int x = 0; x < 8; x++) {
+          if (byte >> x & 1)
+            value += piece_values[piece] + tables[piece][(7 - y) * 8 + x];
+        }
+        values[piece][y][byte] = value;
+      }
+    }
+  }
+}
+
+static const RankTables rank_tables;
+
+// Pawn structures repeat across a set of positions much as they do across
+// a search, so they're cached the same way, by pawn-only Zobrist key
+static thread_local PawnHashTable pawn_table;
+
+void PositionBatch::clear()
+{
+  for (int colour = BLACK; colour <= WHITE; colour++) {
+    for (int piece = PAWN; piece <= KING; piece++)
+      pieces[colour][piece].clear();
+  }
+  endgame.clear();
+}
+
+void PositionBatch::reserve(size_t count)
+{
+  for (int colour = BLACK; colour <= WHITE; colour++) {
+    for (int piece = PAWN; piece <= KING; piece++)
+      pieces[colour][piece].reserve(count);
+  }
+  endgame.reserve(count);
+}
+
+void PositionBatch::add(const BoardState& state)
+{
+  uint64_t bitboards[2][6] = {};
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      const Square& sq = state.board[y][x];
+      if (sq.occupancy != NONE)
+        bitboards[sq.colour][sq.occupancy] |= 1ULL << (y * 8 + x);
+    }
+  }
+  for (int colour = BLACK; colour <= WHITE; colour++) {
+    for (int piece = PAWN; piece <= KING; piece++)
+      pieces[colour][piece].push_back(bitboards[colour][piece]);
+  }
+  endgame.push_back(state.in_endgame());
+}
+
+// Everything but the kings, for one position
+static int evaluate_pieces(const PositionBatch& batch, size_t i)
+{
+  int score = 0;
+  for (int piece = PAWN; piece < KING; piece++) {
+    const uint64_t white = batch.pieces[WHITE][piece][i];
+    const uint64_t black = batch.pieces[BLACK][piece][i];
+    for (int y = 0; y < 8; y++) {
+      score += rank_tables.values[piece][y][white >> (8 * y) & 0xFF];
+      score -= rank_tables.values[piece][7 - y][black >> (8 * y) & 0xFF];
+    }
+  }
+  for (int colour = BLACK; colour <= WHITE; colour++) {
+    uint64_t bishops = batch.pieces[colour][BISHOP][i];
+    bishops &= bishops - 1;
+    if (bishops && !(bishops & (bishops - 1)))
+      score += colour == WHITE ? bishop_pair_bonus : -bishop_pair_bonus;
+  }
+  return score;
+}
+
+#ifdef __AVX2__
+// Everything but the kings, for positions i to i + 3
+static void evaluate_pieces_avx2(const PositionBatch& batch, size_t i, int* scores)
+{
+  const __m256i byte_mask = _mm256_set1_epi64x(0xFF);
+  const __m256i one = _mm256_set1_epi64x(1);
+  const __m256i zero = _mm256_setzero_si256();
+  __m128i score = _mm_setzero_si128();
+  for (int piece = PAWN; piece < KING; piece++) {
+    const __m256i white = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(&batch.pieces[WHITE][piece][i]));
+    const __m256i black = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(&batch.pieces[BLACK][piece][i]));
+    for (int y = 0; y < 8; y++) {
+      const __m256i shift = _mm256_set1_epi64x(8 * y);
+      const __m256i white_bytes = _mm256_and_si256(_mm256_srlv_epi64(white, shift), byte_mask);
+      const __m256i black_bytes = _mm256_and_si256(_mm256_srlv_epi64(black, shift), byte_mask);
+      score = _mm_add_epi32(score,
+        _mm256_i64gather_epi32(rank_tables.values[piece][y], white_bytes, 4));
+      score = _mm_sub_epi32(score,
+        _mm256_i64gather_epi32(rank_tables.values[piece][7 - y], black_bytes, 4));
+    }
+  }
+
+  // Exactly two bishops leave a bit behind when the lowest is cleared, and
+  // none when it is cleared again
+  const __m256i pick_low_halves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  for (int colour = BLACK; colour <= WHITE; colour++) {
+    const __m256i bishops = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(&batch.pieces[colour][BISHOP][i]));
+    const __m256i second = _mm256_and_si256(bishops, _mm256_sub_epi64(bishops, one));
+    const __m256i third = _mm256_and_si256(second, _mm256_sub_epi64(second, one));
+    const __m256i pair = _mm256_andnot_si256(_mm256_cmpeq_epi64(second, zero),
+      _mm256_cmpeq_epi64(third, zero));
+    const __m128i pair_mask = _mm256_castsi256_si128(
+      _mm256_permutevar8x32_epi32(pair, pick_low_halves));
+    const __m128i bonus = _mm_and_si128(pair_mask, _mm_set1_epi32(bishop_pair_bonus));
+    score = colour == WHITE ? _mm_add_epi32(score, bonus) : _mm_sub_epi32(score, bonus);
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(scores), score);
+}
+#endif
+
+static int pawn_structure(const uint64_t pawns[2])
+{
+  uint64_t pawn_hash = 0;
+  for (int colour = BLACK; colour <= WHITE; colour++) {
+    const PieceType piece_type = static_cast<PieceType>(!colour * 6 + PAWN);
+    uint64_t squares = pawns[colour];
+    while (squares) {
+      const int square = pop_lowest_square(squares);
+      zobrist_xor_piece(pawn_hash, piece_type, square % 8, square / 8);
+    }
+  }
+  int score;
+  if (!pawn_table.search(pawn_hash, score)) {
+    score = evaluate_pawn_structure(pawns);
+    pawn_table.add(pawn_hash, score);
+  }
+  return score;
+}
+
+// King placement, king shelter and pawn structure, for one position
+static int evaluate_kings_and_pawns(const PositionBatch& batch, size_t i)
+{
+  const uint64_t pawns[2] = { batch.pieces[BLACK][PAWN][i], batch.pieces[WHITE][PAWN][i] };
+  const bool endgame = batch.endgame[i] != 0;
+  const int* king_pst = endgame ? king_eg_pst : king_mg_pst;
+  int score = 0;
+  for (int colour = BLACK; colour <= WHITE; colour++) {
+    const int forwards = colour == WHITE ? 1 : -1;
+    uint64_t kings = batch.pieces[colour][KING][i];
+    while (kings) {
+      const int square = pop_lowest_square(kings);
+      const int x = square % 8, y = square / 8;
+      int king_score = piece_values[KING] + king_pst[(colour == WHITE ? 7 - y : y) * 8 + x];
+      if (!endgame && (pawns[colour] & (square_bit(x, y + forwards) | square_bit(x, y + 2 * forwards))))
+        king_score += king_shelter_bonus;
+      score += forwards * king_score;
+    }
+  }
+  return score + pawn_structure(pawns);
+}
+
+void evaluate_batch(const PositionBatch& batch, int* scores)
+{
+  const size_t count = batch.size();
+  size_t i = 0;
+#ifdef __AVX2__
+  for (; i + 4 <= count; i += 4)
+    evaluate_pieces_avx2(batch, i, scores + i);
+#endif
+  for (; i < count; i++)
+    scores[i] = evaluate_pieces(batch, i);
+  for (i = 0; i < count; i++)
+    scores[i] += evaluate_kings_and_pawns(batch, i);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Chess.h"
+
+using namespace std;
+
+// Positions in structure-of-arrays layout: one array per colour and piece,
+// holding that bitboard of every position in turn, so the same bitboard of
+// neighbouring positions can be loaded together. Bit y * 8 + x stands for
+// board[y][x].
+class PositionBatch {
+public:
+  void clear();
+  void reserve(size_t count);
+  // The position should be one whose classical_evaluation() holds
+  void add(const BoardState& state);
+  size_t size() const { return endgame.size(); }
+
+  vector<uint64_t> pieces[2][6];
+  // BoardState::in_endgame(), which depends on how the game reached the
+  // position as well as on what is left on the board
+  vector<uint8_t> endgame;
+};
+
+// Scores every position from white's point of view, exactly as
+// BoardState::evaluate() does for the positions it evaluates classically.
+// Material, piece-square tables and the bishop pair are summed for four
+// positions at a time with AVX2 when the build has it, or one at a time
+// otherwise; king placement and pawn structure are added a position at a
+// time. scores must have room for batch.size() values.
+void evaluate_batch(const PositionBatch& batch, int* scores);
@@ -1,21 +1,113 @@
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 #include <thread>
 #include <cassert>
 
 #include "Chess.h"
+#include "AnalysisServer.h"
+#include "Attacks.h"
+#include "Console.h"
+#include "Endgame.h"
+#include "EvalCache.h"
+#include "LoadGenerator.h"
+#include "MateSolver.h"
+#include "Nnue.h"
+#include "PawnHashTable.h"
+#include "Pgn.h"
 #include "PieceSquareTables.h"
+#include "PolyglotBook.h"
+#include "SearchContext.h"
+#include "SearchStats.h"
+#include "SelfPlay.h"
+#include "Syzygy.h"
+#include "SyzygyCheck.h"
+#include "Trace.h"
+#include "Tuner.h"
 #include "TranspositionTable.h"
 #include "Utils.h"
+#include "Zobrist.h"
 
-static Variant variant = VARIANT_NONE;
+// Each thread makes positions in the variant it was given, so searches of
+// different variants can run side by side
+static thread_local Variant variant = VARIANT_NONE;
+// The table shared by the game's searches and the analysis server's
 static TranspositionTable* ttable;
-static int positions_checked;
+static PolyglotBook* book;
+static BookSelection book_selection = BOOK_BEST;
+static string search_stats_file;
+
+// Evaluation caches belong to the thread using them
+static thread_local PawnHashTable pawn_table;
+static thread_local EvalCache eval_cache;
+
+// Searches think for this long, finishing the iteration they are in
+static const double think_time = 5.0;
+static bool ponder_enabled = false;
+// Number of root moves to search to an exact score and report
+static int multi_pv = 1;
+// Fixed limits on the engine's searches, or 0 for none. Setting either
+// turns the clock off, so the engine plays the same moves however busy the
+// machine is.
+static int depth_limit = 0;
+static uint64_t node_limit = 0;
+
+// Set to run as an analysis server or its load generator instead of playing
+static int server_port = 0;
+static int num_threads = max(1, static_cast<int>(thread::hardware_concurrency()));
+static int load_test_port = 0;
+static int load_connections = 8;
+static int load_requests = 20;
+static int load_depth = 5;
+static vector<string> replay_files;
+// Set to generate training positions by self-play instead of playing
+static SelfPlaySettings self_play;
+// Self-play searches this many nodes a move unless given a Depth or Nodes
+static const uint64_t self_play_nodes = 10000;
+// Set to tune the evaluation on a file of training positions
+static TunerSettings tuner;
+// Set to check the tablebases against the engine's own solution of them
+static bool syzygy_check = false;
+// Positions of each table checked when tables are loaded, before any is
+// trusted in a search
+static const int syzygy_samples = 8;
+// Never reset, so the search and the main thread can share its readings
+static const Timer search_clock;
+// A ponder search has no time limit, until a ponder hit lets the main
+// thread stop it
+static atomic<bool> pondering(false);
+
+void set_variant(Variant v)
+{
+  variant = v;
+}
+
+// The network only knows standard chess
+static bool nnue_active()
+{
+  return variant == VARIANT_NONE && nnue_loaded();
+}
 
 static bool within_bounds(int x, int y)
 {
   return x >= 0 && x < 8 && y >= 0 && y < 8;
 }
 
+// Everything the move generator needs to know about the side to move, so
+// it can be specialised for each colour rather than branching on whites_turn
+template <PieceColour Us>
+struct ColourTraits {
+  static constexpr PieceColour them = Us == WHITE ? BLACK : WHITE;
+  static constexpr int forwards = Us == WHITE ? 1 : -1;
+  static constexpr int pawn_rank = Us == WHITE ? 1 : 6;
+  static constexpr int back_rank = Us == WHITE ? 0 : 7;
+  static constexpr CastlingRight kingside = Us == WHITE ? WHITE_KINGSIDE : BLACK_KINGSIDE;
+  static constexpr CastlingRight queenside = Us == WHITE ? WHITE_QUEENSIDE : BLACK_QUEENSIDE;
+};
+
 static const Piece back_rank[] = {
   ROOK,
   KNIGHT,
@@ -29,15 +121,18 @@ static const Piece back_rank[] = {
 
 BoardState::BoardState(void)
   : whites_turn(true)
-  , en_passant_available(0, 0)
+  , en_passant_available(-1, -1)
   , castling_rights{ true, true, true, true }
   , material{ 0 }
   , previous_state(nullptr)
   , previous_move(nullptr)
   , zobrist_hash(0)
+  , pawn_hash(0)
   , endgame_reached(false)
   , eval(0)
+  , evaluated(false)
 {
+  accumulator.dirty[BLACK] = accumulator.dirty[WHITE] = true;
   for (int y = 2; y < 6; y ++) {
     for (int x = 0; x < 8; x++) {
       board[y][x].occupancy = NONE;
@@ -61,26 +156,167 @@ BoardState::BoardState(void)
   psts[ROOK] = rook_pst;
   psts[QUEEN] = queen_pst;
   psts[KING] = king_mg_pst;
+  zobrist_xor_variant(zobrist_hash, variant);
+
+  if (nnue_active())
+    refresh_accumulator();
 
   enumerate_all_moves();
+  moves_enumerated = true;
 }
 
-BoardState::BoardState(const BoardState *prev_state, const Move *move, bool enum_moves)
+// Replaces the position with one given in Forsyth-Edwards Notation. The
+// move counters are accepted but ignored, as no fifty-move count is kept.
+bool BoardState::load_fen(const string& fen)
+{
+  istringstream in(fen);
+  string placement, side, castling, en_passant;
+  if (!(in >> placement >> side >> castling >> en_passant) ||
+      (side != "w" && side != "b"))
+    return false;
+
+  zobrist_hash = 0;
+  zobrist_xor_variant(zobrist_hash, variant);
+  pawn_hash = 0;
+  memset(material, 0, sizeof(material));
+  accumulator.dirty[BLACK] = accumulator.dirty[WHITE] = true;
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++)
+      board[y][x].occupancy = NONE;
+  }
+
+  static const string piece_letters = "pnbrqk";
+  int x = 0, y = 7;
+  for (char c : placement) {
+    if (c == '/') {
+      if (x != 8 || y == 0)
+        return false;
+      x = 0;
+      y--;
+    } else if (c >= '1' && c <= '8') {
+      x += c - '0';
+      if (x > 8)
+        return false;
+    } else {
+      const size_t piece = piece_letters.find(static_cast<char>(tolower(c)));
+      if (piece == string::npos || x > 7 || (piece == PAWN && (y == 0 || y == 7)))
+        return false;
+      add_piece(x, y, static_cast<Piece>(piece), isupper(c) ? WHITE : BLACK);
+      x++;
+    }
+  }
+  if (x != 8 || y != 0 || material[WHITE][KING] != 1 || material[BLACK][KING] != 1)
+    return false;
+
+  whites_turn = side == "w";
+  if (!whites_turn)
+    zobrist_xor_player(zobrist_hash);
+
+  // Rights are only kept while the king and rook are still on their squares.
+  // Lost rights are hashed, as they are when make_move() takes them away.
+  static const string castling_letters = "KQkq";
+  for (int i = 0; i < 4; i++) {
+    const int back_rank = i < 2 ? 0 : 7;
+    const int rook_x = i % 2 ? 0 : 7;
+    const PieceColour colour = i < 2 ? WHITE : BLACK;
+    castling_rights[i] = castling.find(castling_letters[i]) != string::npos &&
+      board[back_rank][4].occupancy == KING && board[back_rank][4].colour == colour &&
+      board[back_rank][rook_x].occupancy == ROOK && board[back_rank][rook_x].colour == colour;
+    if (!castling_rights[i])
+      zobrist_xor_castling_rights(zobrist_hash, static_cast<CastlingRight>(i));
+  }
+
+  en_passant_available = Coords(-1, -1);
+  if (en_passant != "-") {
+    if (en_passant.size() != 2 || en_passant[0] < 'a' || en_passant[0] > 'h' ||
+        en_passant[1] != (whites_turn ? '6' : '3'))
+      return false;
+    en_passant_available = Coords(en_passant[0] - 'a', en_passant[1] - '1');
+    zobrist_xor_en_passant(zobrist_hash, en_passant_available.x);
+  }
+
+  psts[PAWN] = pawn_pst;
+  psts[KNIGHT] = knight_pst;
+  psts[BISHOP] = bishop_pst;
+  psts[ROOK] = rook_pst;
+  psts[QUEEN] = queen_pst;
+  psts[KING] = king_mg_pst;
+  int players_in_endgame = 0;
+  for (int i = 0; i < 2; i++) {
+    if (material[i][QUEEN] == 0 ||
+        material[i][KNIGHT] + material[i][BISHOP] + material[i][ROOK] < 2)
+      players_in_endgame++;
+  }
+  endgame_reached = players_in_endgame == 2;
+  if (endgame_reached)
+    psts[KING] = king_eg_pst;
+
+  // The side that just moved can't have left its king in check
+  if (in_check(whites_turn ? BLACK : WHITE))
+    return false;
+
+  previous_state = nullptr;
+  previous_move = nullptr;
+  eval = 0;
+  evaluated = false;
+  if (nnue_active())
+    refresh_accumulator();
+  possible_moves.clear();
+  enumerate_all_moves();
+  moves_enumerated = true;
+  return true;
+}
+
+// Copies the parts of the previous position that make_move() builds on
+BoardState::BoardState(const BoardState *prev_state)
   : zobrist_hash(prev_state->zobrist_hash)
+  , pawn_hash(prev_state->pawn_hash)
   , en_passant_available{ -1, -1 }
-  , endgame_reached(prev_state->endgame_reached)
   , eval(0)
   , evaluated(false)
+  , endgame_reached(prev_state->endgame_reached)
 {
   memcpy(board, prev_state->board, sizeof(board));
   memcpy(castling_rights, prev_state->castling_rights, sizeof(castling_rights));
   memcpy(psts, prev_state->psts, sizeof(psts));
   memcpy(material, prev_state->material, sizeof(material));
+  memcpy(king_squares, prev_state->king_squares, sizeof(king_squares));
+  if (nnue_active())
+    memcpy(&accumulator, &prev_state->accumulator, sizeof(accumulator));
+  else
+    accumulator.dirty[BLACK] = accumulator.dirty[WHITE] = true;
+}
+
+BoardState::BoardState(const BoardState *prev_state, const Move *move, bool enum_moves)
+  : BoardState(prev_state)
+{
+  switch (variant) {
+  case VARIANT_ATOMIC:
+    make_move<VARIANT_ATOMIC>(prev_state, move, enum_moves);
+    break;
+  case VARIANT_HILL:
+    make_move<VARIANT_HILL>(prev_state, move, enum_moves);
+    break;
+  default:
+    make_move<VARIANT_NONE>(prev_state, move, enum_moves);
+    break;
+  }
+}
+
+template <Variant V>
+BoardState::BoardState(VariantTag<V>, const BoardState *prev_state, const Move *move, bool enum_moves)
+  : BoardState(prev_state)
+{
+  make_move<V>(prev_state, move, enum_moves);
+}
 
+template <Variant V>
+void BoardState::make_move(const BoardState *prev_state, const Move *move, bool enum_moves)
+{
   bool piece_captured = false;
 
   if (prev_state->en_passant_available.x >= 0) {
-    ttable->zobrist_xor_en_passant(
+    zobrist_xor_en_passant(
       zobrist_hash, prev_state->en_passant_available.x);
   }
 
@@ -90,7 +326,7 @@ BoardState::BoardState(const BoardState *prev_state, const Move *move, bool enum
       // Mark a double-moving pawn as able to be captured en passant
       en_passant_available =
         Coords(move->from.x, move->from.y + pawn_displacement / 2);
-      ttable->zobrist_xor_en_passant(zobrist_hash, move->from.x);
+      zobrist_xor_en_passant(zobrist_hash, move->from.x);
     } else if (move->from.x != move->to.x &&
       board[move->to.y][move->to.x].occupancy == NONE) {
       // If a pawn moved diagonally to an unoccupied square, it's en passant
@@ -122,29 +358,23 @@ BoardState::BoardState(const BoardState *prev_state, const Move *move, bool enum
          move->from == Coords(rook_x, back_rank) ||
          move->to   == Coords(rook_x, back_rank))) {
       castling_rights[i] = false;
-      ttable->zobrist_xor_castling_rights(
+      zobrist_xor_castling_rights(
         zobrist_hash, static_cast<CastlingRight>(i));
     }
   }
 
-  switch (variant) {
+  switch (V) {
   case VARIANT_ATOMIC:
-    if (board[move->to.y][move->to.x].occupancy != NONE) {
-      for (int dx = -1; dx <= 1; dx++) {
-        for (int dy = -1; dy <= 1; dy++) {
-          if (!within_bounds(move->to.x + dx, move->to.y + dy))
-            continue;
-          switch (board[move->to.y + dy][move->to.x + dx].occupancy) {
-          case NONE:
-            break;
-          case PAWN:
-            if (dx || dy)
-              break;
-          default:
-            remove_piece(move->to.x + dx, move->to.y + dy);
-            piece_captured = true;
-            break;
-          }
+    // An en passant capture has already taken its pawn, but still explodes
+    if (board[move->to.y][move->to.x].occupancy != NONE || piece_captured) {
+      const int to = move->to.y * 8 + move->to.x;
+      uint64_t blast = attack_tables.explosion[to];
+      while (blast) {
+        const int square = pop_lowest_square(blast);
+        const Piece piece = board[square / 8][square % 8].occupancy;
+        if (piece != NONE && (piece != PAWN || square == to)) {
+          remove_piece(square % 8, square / 8);
+          piece_captured = true;
         }
       }
     } else {
@@ -158,14 +388,8 @@ BoardState::BoardState(const BoardState *prev_state, const Move *move, bool enum
     break;
   default:
     if (board[move->to.y][move->to.x].occupancy != NONE) {
-      material[board[move->to.y][move->to.x].colour][board[move->to.y][move->to.x].occupancy]--;
+      remove_piece(move->to.x, move->to.y);
       piece_captured = true;
-      (material[WHITE][QUEEN] == 0 || material[WHITE][KNIGHT] + material[WHITE][BISHOP] + material[WHITE][ROOK] < 2);
-      // remove taken piece from hash
-      ttable->zobrist_xor_piece(zobrist_hash, static_cast<PieceType>(
-          !board[move->to.y][move->to.x].colour * 6 +
-          board[move->to.y][move->to.x].occupancy
-        ), move->to.x, move->to.y);
     }
     add_piece(move->to.x, move->to.y, board[move->from.y][move->from.x]);
     remove_piece(move->from.x, move->from.y);
@@ -179,10 +403,13 @@ BoardState::BoardState(const BoardState *prev_state, const Move *move, bool enum
   }
 
   whites_turn = !prev_state->whites_turn;
-  ttable->zobrist_xor_player(zobrist_hash);
+  zobrist_xor_player(zobrist_hash);
+
+  if (nnue_active())
+    refresh_accumulator();
 
   if (enum_moves)
-    enumerate_all_moves();
+    enumerate_all_moves<V>();
   moves_enumerated = enum_moves;
 
   if (!endgame_reached && piece_captured) {
@@ -201,7 +428,6 @@ BoardState::BoardState(const BoardState *prev_state, const Move *move, bool enum
 
   previous_state = prev_state;
   previous_move = move;
-  positions_checked++;
 
   // Check for draw by repetition
   int repetitions = 1;
@@ -219,122 +445,349 @@ BoardState::BoardState(const BoardState *prev_state, const Move *move, bool enum
   }
 }
 
+template <PieceColour Us>
 bool BoardState::can_move_to_space(int x, int y) {
   return within_bounds(x, y) && (board[y][x].occupancy == NONE ||
-    (board[y][x].colour == BLACK) == whites_turn);
+    board[y][x].colour == ColourTraits<Us>::them);
 }
 
-bool BoardState::king_in_check(int x, int y) {
-  // check diagonals
-  for (int i = -1; i <= 1; i += 2) {
-    for (int j = -1; j <= 1; j += 2) {
-      int m = 1;
-      while (can_move_to_space(x + i * m, y + j * m)) {
-        if (board[y + j * m][x + i * m].occupancy == BISHOP ||
-            board[y + j * m][x + i * m].occupancy == QUEEN)
+// Whether a piece of the given type and colour stands on any of the squares
+static bool any_piece_on(const Square board[8][8], uint64_t squares, Piece piece, PieceColour colour)
+{
+  while (squares) {
+    const int square = pop_lowest_square(squares);
+    const Square& sq = board[square / 8][square % 8];
+    if (sq.occupancy == piece && sq.colour == colour)
+      return true;
+  }
+  return false;
+}
+
+bool BoardState::square_attacked(int x, int y, PieceColour attacker, bool kings_attack) const
+{
+  for (int d = 0; d < NUM_DIRECTIONS; d++) {
+    const Piece slider = d < DIR_NORTH_EAST ? ROOK : BISHOP;
+    int i = x + direction_offsets[d][0], j = y + direction_offsets[d][1];
+    while (within_bounds(i, j)) {
+      if (board[j][i].occupancy != NONE) {
+        if (board[j][i].colour == attacker &&
+            (board[j][i].occupancy == slider || board[j][i].occupancy == QUEEN))
           return true;
-        if (board[y + j * m][x + i * m].occupancy != NONE)
-          break;
-        m++;
+        break;
       }
+      i += direction_offsets[d][0];
+      j += direction_offsets[d][1];
     }
   }
-  // check orthogonals
-  for (int i = -1; i <= 1; i += 2) {
-    int m = 1;
-    while (can_move_to_space(x + i * m, y)) {
-      if (board[y][x + i * m].occupancy == ROOK ||
-          board[y][x + i * m].occupancy == QUEEN)
-        return true;
-      if (board[y][x + i * m].occupancy != NONE)
-        break;
-      m++;
-    }
-    m = 1;
-    while (can_move_to_space(x, y + i * m)) {
-      if (board[y + i * m][x].occupancy == ROOK ||
-          board[y + i * m][x].occupancy == QUEEN)
-        return true;
-      if (board[y + i * m][x].occupancy != NONE)
-        break;
-      m++;
-    }
+  const int square = y * 8 + x;
+  // Pawns attack this square from wherever a pawn of the other colour
+  // standing on it would attack
+  return any_piece_on(board, attack_tables.knight[square], KNIGHT, attacker) ||
+    any_piece_on(board, attack_tables.pawn[!attacker][square], PAWN, attacker) ||
+    (kings_attack && any_piece_on(board, attack_tables.king[square], KING, attacker));
+}
+
+// Whether a king on (x, y) could be taken. In atomic kings never capture,
+// and a king touching the enemy king can't be taken at all, as the capture
+// would blow up the capturer's own king too.
+template <Variant V>
+bool BoardState::king_attacked(int x, int y, PieceColour attacker) const
+{
+  if (V != VARIANT_ATOMIC)
+    return square_attacked(x, y, attacker);
+  return !any_piece_on(board, attack_tables.king[y * 8 + x], KING, attacker) &&
+    square_attacked(x, y, attacker, false);
+}
+
+// Pieces next to an atomic king are a liability: capturing any of them
+// takes the king with it. Counts those the opponent can already capture.
+int BoardState::exploding_king_danger(int x, int y) const
+{
+  const PieceColour colour = board[y][x].colour;
+  const PieceColour attacker = static_cast<PieceColour>(!colour);
+  if (any_piece_on(board, attack_tables.king[y * 8 + x], KING, attacker))
+    return 0;
+  int danger = 0;
+  uint64_t neighbours = attack_tables.king[y * 8 + x];
+  while (neighbours) {
+    const int square = pop_lowest_square(neighbours);
+    const Square& sq = board[square / 8][square % 8];
+    if (sq.occupancy != NONE && sq.colour == colour &&
+        square_attacked(square % 8, square / 8, attacker, false))
+      danger++;
   }
-  // check pawn captures
-  const int enemy_pawn_move_direction = whites_turn ? -1 : 1;
-  for (int i = -1; i <= 1; i += 2) {
-    if (can_move_to_space(x + i, y - enemy_pawn_move_direction) &&
-        board[y - enemy_pawn_move_direction][x + i].occupancy == PAWN)
-      return true;
+  return danger;
+}
+
+// Whether colour's king could step straight onto a centre square that its
+// own pieces leave free and the opponent doesn't guard
+bool BoardState::hill_step_available(PieceColour colour)
+{
+  if (!material[colour][KING])
+    return false;
+  const int king = king_squares[colour];
+  uint64_t targets = attack_tables.king[king] & hill_mask;
+  if (!targets)
+    return false;
+  const PieceColour attacker = static_cast<PieceColour>(!colour);
+  // Lifted so that it doesn't block a slider guarding the square behind it
+  board[king / 8][king % 8].occupancy = NONE;
+  bool available = false;
+  while (targets && !available) {
+    const int square = pop_lowest_square(targets);
+    const Square& sq = board[square / 8][square % 8];
+    available = (sq.occupancy == NONE || sq.colour != colour) &&
+      !square_attacked(square % 8, square / 8, attacker);
   }
-  // check for adjacent king
-  for (int i = -1; i <= 1; i++) {
-    for (int j = -1; j <= 1; j++) {
-      if (i == 0 && j == 0)
-        continue;
-      if (can_move_to_space(x + i, y + j) &&
-          board[y + j][x + i].occupancy == KING)
-        return true;
+  board[king / 8][king % 8].occupancy = KING;
+  return available;
+}
+
+bool BoardState::in_check(PieceColour colour) const
+{
+  if (!material[colour][KING])
+    return false;
+  const int x = king_squares[colour] % 8, y = king_squares[colour] / 8;
+  const PieceColour attacker = static_cast<PieceColour>(!colour);
+  return variant == VARIANT_ATOMIC ? king_attacked<VARIANT_ATOMIC>(x, y, attacker) :
+    square_attacked(x, y, attacker);
+}
+
+bool BoardState::king_on_hill(PieceColour colour) const
+{
+  return material[colour][KING] && (hill_mask & (1ULL << king_squares[colour]));
+}
+
+bool BoardState::side_to_move_lost() const
+{
+  const PieceColour us = whites_turn ? WHITE : BLACK;
+  switch (variant) {
+  case VARIANT_ATOMIC:
+    return !material[us][KING] || in_check(us);
+  case VARIANT_HILL:
+    return king_on_hill(static_cast<PieceColour>(!us)) || in_check(us);
+  default:
+    return in_check(us);
+  }
+}
+
+// Follows the order of the checks in evaluate()
+bool BoardState::classical_evaluation() const
+{
+  if (variant != VARIANT_NONE || (moves_enumerated && possible_moves.empty()))
+    return false;
+  int endgame_score;
+  if (endgame_reached && evaluate_endgame(board, material, whites_turn, endgame_score))
+    return false;
+  return !(nnue_loaded() && !accumulator.dirty[BLACK] && !accumulator.dirty[WHITE]);
+}
+
+bool BoardState::any_castling_rights() const
+{
+  return castling_rights[0] || castling_rights[1] ||
+    castling_rights[2] || castling_rights[3];
+}
+
+int BoardState::piece_count(PieceColour colour, Piece piece) const
+{
+  return material[colour][piece];
+}
+
+void BoardState::enumerate_all_moves()
+{
+  switch (variant) {
+  case VARIANT_ATOMIC:
+    enumerate_all_moves<VARIANT_ATOMIC>();
+    break;
+  case VARIANT_HILL:
+    enumerate_all_moves<VARIANT_HILL>();
+    break;
+  default:
+    enumerate_all_moves<VARIANT_NONE>();
+    break;
+  }
+}
+
+void BoardState::EnumerateMoves()
+{
+  if (!moves_enumerated) {
+    enumerate_all_moves();
+    moves_enumerated = true;
+  }
+}
+
+// Finds the pieces checking the side to move's king and its own pieces
+// pinned against it. Afterwards check_mask holds the squares a non-king
+// move must land on: everywhere when not in check, the checker and the
+// squares between it and the king in single check, and nowhere in double
+// check. Returns the number of checkers.
+template <PieceColour Us>
+int BoardState::find_checks_and_pins()
+{
+  const PieceColour us = Us;
+  const PieceColour them = ColourTraits<Us>::them;
+
+  check_mask = ~0ULL;
+  pinned = 0;
+  if (!material[us][KING]) {
+    king_square = Coords(-1, -1);
+    return 0;
+  }
+  king_square = Coords(king_squares[us] % 8, king_squares[us] / 8);
+
+  const int kx = king_square.x, ky = king_square.y;
+  int num_checkers = 0;
+  uint64_t evasions = 0;
+
+  for (int d = 0; d < NUM_DIRECTIONS; d++) {
+    const Piece slider = d < DIR_NORTH_EAST ? ROOK : BISHOP;
+    uint64_t ray = 0;
+    int blocker = -1;
+    int i = kx + direction_offsets[d][0], j = ky + direction_offsets[d][1];
+    while (within_bounds(i, j)) {
+      ray |= 1ULL << (j * 8 + i);
+      const Square& sq = board[j][i];
+      if (sq.occupancy != NONE) {
+        const bool attacker = sq.colour == them &&
+          (sq.occupancy == slider || sq.occupancy == QUEEN);
+        if (sq.colour == us) {
+          if (blocker >= 0)
+            break;
+          blocker = j * 8 + i;
+        } else if (attacker && blocker >= 0) {
+          pinned |= 1ULL << blocker;
+          break;
+        } else if (attacker) {
+          num_checkers++;
+          evasions |= ray;
+          break;
+        } else {
+          break;
+        }
+      }
+      i += direction_offsets[d][0];
+      j += direction_offsets[d][1];
     }
   }
-  return false;
+
+  // Knights and pawns checking the king stand where one of ours on the
+  // king's square would attack
+  const int king_index = ky * 8 + kx;
+  uint64_t contacts[2] = {
+    attack_tables.knight[king_index], attack_tables.pawn[Us][king_index],
+  };
+  const Piece contact_pieces[2] = { KNIGHT, PAWN };
+  for (int k = 0; k < 2; k++) {
+    while (contacts[k]) {
+      const int square = pop_lowest_square(contacts[k]);
+      const Square& sq = board[square / 8][square % 8];
+      if (sq.occupancy == contact_pieces[k] && sq.colour == them) {
+        num_checkers++;
+        evasions |= 1ULL << square;
+      }
+    }
+  }
+
+  if (num_checkers)
+    check_mask = num_checkers == 1 ? evasions : 0;
+  return num_checkers;
+}
+
+// The line a pinned piece at (x, y) may still move along: every square from
+// the king outwards through the piece
+uint64_t BoardState::pin_ray(int x, int y) const
+{
+  const int dx = (x > king_square.x) - (x < king_square.x);
+  const int dy = (y > king_square.y) - (y < king_square.y);
+  for (int d = 0; d < NUM_DIRECTIONS; d++) {
+    if (direction_offsets[d][0] == dx && direction_offsets[d][1] == dy)
+      return attack_tables.rays[d][king_square.y * 8 + king_square.x];
+  }
+  return 0;
+}
+
+// En passant removes two pawns from the same rank at once, which can uncover
+// a check the pin masks don't see, so it's tested by trying it on the board
+template <Variant V, PieceColour Us>
+bool BoardState::en_passant_legal(int x, int y, int to_x)
+{
+  // Atomic captures are tested along with the other explosions
+  if (V == VARIANT_ATOMIC)
+    return true;
+  const int to_y = en_passant_available.y;
+  const Square moving = board[y][x];
+  const Square captured = board[y][to_x];
+  board[to_y][to_x] = moving;
+  board[y][x].occupancy = NONE;
+  board[y][to_x].occupancy = NONE;
+  const bool legal = !square_attacked(king_square.x, king_square.y,
+    ColourTraits<Us>::them);
+  board[y][to_x] = captured;
+  board[y][x] = moving;
+  board[to_y][to_x].occupancy = NONE;
+  return legal;
 }
 
 void BoardState::add_move(Coords& from, Coords& to)
 {
+  if (!(from == king_square)) {
+    const uint64_t to_bit = 1ULL << (to.y * 8 + to.x);
+    if (!(check_mask & to_bit))
+      return;
+    if ((pinned >> (from.y * 8 + from.x) & 1) && !(pin_ray(from.x, from.y) & to_bit))
+      return;
+  }
   possible_moves.emplace_back(from, to);
 }
 
+template <Variant V, PieceColour Us>
 void BoardState::add_pawn_moves(int x, int y) {
-  const int pawn_move_direction = whites_turn ? 1 : -1;
+  const int pawn_move_direction = ColourTraits<Us>::forwards;
   Coords from(x, y);
   if (board[y + pawn_move_direction][x].occupancy == NONE) {
     Coords to(x, y + pawn_move_direction);
     add_move(from, to);
-    if (y == (7 + pawn_move_direction) % 7 &&
+    if (y == ColourTraits<Us>::pawn_rank &&
       board[y + 2 * pawn_move_direction][x].occupancy == NONE) {
       Coords to(x, y + 2 * pawn_move_direction);
       add_move(from, to);
     }
   }
   for (int i = -1; i <= 1; i += 2) {
-    if (within_bounds(x + i, y + pawn_move_direction) &&
-        (
-          (board[y + pawn_move_direction][x + i].occupancy != NONE &&
-            (board[y + pawn_move_direction][x + i].colour == BLACK) == whites_turn)
-          ||
-          (en_passant_available.x == x + i &&
-           en_passant_available.y == y + pawn_move_direction)
-          )
-        ) {
-      Coords to(x + i, y + pawn_move_direction);
+    if (!within_bounds(x + i, y + pawn_move_direction))
+      continue;
+    Coords to(x + i, y + pawn_move_direction);
+    if (board[y + pawn_move_direction][x + i].occupancy != NONE &&
+        board[y + pawn_move_direction][x + i].colour == ColourTraits<Us>::them) {
       add_move(from, to);
+    } else if (en_passant_available.x == x + i &&
+        en_passant_available.y == y + pawn_move_direction &&
+        en_passant_legal<V, Us>(x, y, x + i)) {
+      possible_moves.emplace_back(from, to);
     }
   }
 }
 
+template <PieceColour Us>
 void BoardState::add_knight_moves(int x, int y) {
   Coords from(x, y);
-  for (int d2 = -2; d2 <= 2; d2 += 4) {
-    for (int d1 = -1; d1 <= 1; d1 += 2) {
-      if (can_move_to_space(x + d2, y + d1)) {
-        Coords to(x + d2, y + d1);
-        add_move(from, to);
-      }
-      if (can_move_to_space(x + d1, y + d2)) {
-        Coords to(x + d1, y + d2);
-        add_move(from, to);
-      }
+  uint64_t targets = attack_tables.knight[y * 8 + x];
+  while (targets) {
+    const int square = pop_lowest_square(targets);
+    if (can_move_to_space<Us>(square % 8, square / 8)) {
+      Coords to(square % 8, square / 8);
+      add_move(from, to);
     }
   }
 }
 
+template <PieceColour Us>
 void BoardState::add_bishop_moves(int x, int y) {
   Coords from(x, y);
   for (int i = -1; i <= 1; i += 2) {
     for (int j = -1; j <= 1; j += 2) {
       int m = 1;
-      while (can_move_to_space(x + i * m, y + j * m)) {
+      while (can_move_to_space<Us>(x + i * m, y + j * m)) {
         Coords to(x + i * m, y + j * m);
         add_move(from, to);
         if (board[y + j * m][x + i * m].occupancy != NONE)
@@ -345,11 +798,12 @@ void BoardState::add_bishop_moves(int x, int y) {
   }
 }
 
+template <PieceColour Us>
 void BoardState::add_rook_moves(int x, int y) {
   Coords from(x, y);
   for (int i = -1; i <= 1; i += 2) {
     int m = 1;
-    while (can_move_to_space(x + i * m, y)) {
+    while (can_move_to_space<Us>(x + i * m, y)) {
       Coords to(x + i * m, y);
       add_move(from, to);
       if (board[y][x + i * m].occupancy != NONE)
@@ -357,7 +811,7 @@ void BoardState::add_rook_moves(int x, int y) {
       m++;
     }
     m = 1;
-    while (can_move_to_space(x, y + i * m)) {
+    while (can_move_to_space<Us>(x, y + i * m)) {
       Coords to(x, y + i * m);
       add_move(from, to);
       if (board[y + i * m][x].occupancy != NONE)
@@ -367,75 +821,115 @@ void BoardState::add_rook_moves(int x, int y) {
   }
 }
 
+template <Variant V, PieceColour Us>
 void BoardState::add_king_moves(int x, int y) {
   Coords from(x, y);
-  for (int i = -1; i <= 1; i++) {
-    for (int j = -1; j <= 1; j++) {
-      if (i == 0 && j == 0)
-        continue;
-      if (can_move_to_space(x + i, y + j) &&
-          !king_in_check(x + i, y + j)) {
-        Coords to(x + i, y + j);
-        add_move(from, to);
-      }
+  // Lift the king while testing its destinations, otherwise it shields the
+  // square behind it from the slider checking it
+  board[y][x].occupancy = NONE;
+  const PieceColour them = ColourTraits<Us>::them;
+  uint64_t targets = attack_tables.king[y * 8 + x];
+  while (targets) {
+    const int square = pop_lowest_square(targets);
+    const int to_x = square % 8, to_y = square / 8;
+    // An atomic king capturing would explode along with its victim
+    if (V == VARIANT_ATOMIC && board[to_y][to_x].occupancy != NONE)
+      continue;
+    if (can_move_to_space<Us>(to_x, to_y) && !king_attacked<V>(to_x, to_y, them)) {
+      Coords to(to_x, to_y);
+      add_move(from, to);
     }
   }
-  int back_rank = !whites_turn * 7;
-  if (castling_rights[whites_turn ? WHITE_QUEENSIDE : BLACK_QUEENSIDE] &&
+  const int back_rank = ColourTraits<Us>::back_rank;
+  if (castling_rights[ColourTraits<Us>::queenside] &&
       board[back_rank][1].occupancy == NONE &&
       board[back_rank][2].occupancy == NONE &&
       board[back_rank][3].occupancy == NONE &&
-      !king_in_check(2, back_rank) &&
-      !king_in_check(3, back_rank) &&
-      !king_in_check(4, back_rank)) {
+      !king_attacked<V>(2, back_rank, them) &&
+      !king_attacked<V>(3, back_rank, them) &&
+      !king_attacked<V>(4, back_rank, them)) {
     Coords to(2, back_rank);
     add_move(from, to);
   }
-  if (castling_rights[whites_turn ? WHITE_KINGSIDE : BLACK_KINGSIDE] &&
+  if (castling_rights[ColourTraits<Us>::kingside] &&
       board[back_rank][5].occupancy == NONE &&
       board[back_rank][6].occupancy == NONE &&
-      !king_in_check(4, back_rank) &&
-      !king_in_check(5, back_rank) &&
-      !king_in_check(6, back_rank)) {
+      !king_attacked<V>(4, back_rank, them) &&
+      !king_attacked<V>(5, back_rank, them) &&
+      !king_attacked<V>(6, back_rank, them)) {
     Coords to(6, back_rank);
     add_move(from, to);
   }
+  board[y][x].occupancy = KING;
 }
 
+// In double check only the king can move
+template <Variant V, PieceColour Us>
+void BoardState::enumerate_evasions() {
+  add_king_moves<V, Us>(king_square.x, king_square.y);
+}
+
+template <Variant V>
 void BoardState::enumerate_all_moves() {
+  TRACE_SAMPLED_SCOPE("move generation", 1024);
+  if (whites_turn)
+    enumerate_all_moves<V, WHITE>();
+  else
+    enumerate_all_moves<V, BLACK>();
+}
+
+template <Variant V, PieceColour Us>
+void BoardState::enumerate_all_moves() {
+  // The game is over once the opponent's king has reached the centre
+  if (V == VARIANT_HILL && king_on_hill(ColourTraits<Us>::them))
+    return;
   possible_moves.reserve(50);
+  const int num_checkers = find_checks_and_pins<Us>();
+  // Atomic captures can escape check or break a pin by blowing up the
+  // piece responsible, so its moves are generated freely and then tested.
+  // Only quiet moves are held to the masks, and not at all while the kings
+  // touch, as then neither can be taken.
+  uint64_t quiet_mask = check_mask, quiet_pinned = pinned;
+  if (V == VARIANT_ATOMIC) {
+    if (king_square.x < 0 || !material[ColourTraits<Us>::them][KING])
+      return;
+    if (any_piece_on(board, attack_tables.king[king_square.y * 8 + king_square.x],
+        KING, ColourTraits<Us>::them)) {
+      quiet_mask = ~0ULL;
+      quiet_pinned = 0;
+    }
+    check_mask = ~0ULL;
+    pinned = 0;
+  } else if (num_checkers > 1) {
+    enumerate_evasions<V, Us>();
+    return;
+  }
   bool king_present = false;
   for (int y = 0; y < 8; y++) {
     for (int x = 0; x < 8; x++) {
       if (board[y][x].occupancy == NONE)
         continue;
-      if (whites_turn == (board[y][x].colour == BLACK)) {
-        if (variant == VARIANT_HILL && board[y][x].occupancy == KING &&
-            x >= 3 && x <= 4 && y >= 3 && y <= 4) {
-          possible_moves.clear();
-          return;
-        }
+      if (board[y][x].colour != Us)
         continue;
-      }
       switch (board[y][x].occupancy) {
         case PAWN:
-          add_pawn_moves(x, y);
+          add_pawn_moves<V, Us>(x, y);
           break;
         case KNIGHT:
-          add_knight_moves(x, y);
+          add_knight_moves<Us>(x, y);
           break;
         case BISHOP:
-          add_bishop_moves(x, y);
+          add_bishop_moves<Us>(x, y);
           break;
         case ROOK:
-          add_rook_moves(x, y);
+          add_rook_moves<Us>(x, y);
           break;
         case QUEEN:
-          add_bishop_moves(x, y);
-          add_rook_moves(x, y);
+          add_bishop_moves<Us>(x, y);
+          add_rook_moves<Us>(x, y);
           break;
         case KING:
-          add_king_moves(x, y);
+          add_king_moves<V, Us>(x, y);
           king_present = true;
           break;
         default:
@@ -446,43 +940,251 @@ void BoardState::enumerate_all_moves() {
   }
   if (!king_present)
     possible_moves.clear();
+  if (V == VARIANT_ATOMIC)
+    remove_illegal_atomic_moves<Us>(quiet_mask, quiet_pinned);
+}
+
+// An atomic capture blows up everything but pawns around its square, the
+// capturer included. It may not take our own king with it, always wins if
+// it takes theirs, and otherwise must leave our king safe.
+template <PieceColour Us>
+bool BoardState::atomic_capture_legal(const Move& move)
+{
+  const int to = move.to.y * 8 + move.to.x;
+  const uint64_t blast = attack_tables.explosion[to];
+  if (blast & square_bit(king_square.x, king_square.y))
+    return false;
+  if (any_piece_on(board, blast, KING, ColourTraits<Us>::them))
+    return true;
+
+  // Lift everything the explosion removes, test, then put it all back
+  int lifted[11];
+  Square saved[11];
+  int num_lifted = 0;
+  uint64_t removed = blast & ~(1ULL << to);
+  uint64_t squares = 1ULL << (move.from.y * 8 + move.from.x) | 1ULL << to;
+  if (board[move.to.y][move.to.x].occupancy == NONE)
+    squares |= 1ULL << (move.from.y * 8 + move.to.x); // The pawn taken en passant
+  while (removed) {
+    const int square = pop_lowest_square(removed);
+    if (board[square / 8][square % 8].occupancy != PAWN)
+      squares |= 1ULL << square;
+  }
+  while (squares) {
+    const int square = pop_lowest_square(squares);
+    lifted[num_lifted] = square;
+    saved[num_lifted++] = board[square / 8][square % 8];
+    board[square / 8][square % 8].occupancy = NONE;
+  }
+  const bool legal = !king_attacked<VARIANT_ATOMIC>(king_square.x, king_square.y,
+    ColourTraits<Us>::them);
+  for (int i = 0; i < num_lifted; i++)
+    board[lifted[i] / 8][lifted[i] % 8] = saved[i];
+  return legal;
+}
+
+template <PieceColour Us>
+void BoardState::remove_illegal_atomic_moves(uint64_t quiet_mask, uint64_t quiet_pinned)
+{
+  size_t num_legal = 0;
+  for (size_t i = 0; i < possible_moves.size(); i++) {
+    const Move& move = possible_moves[i];
+    const Square& moving = board[move.from.y][move.from.x];
+    const bool capture = board[move.to.y][move.to.x].occupancy != NONE ||
+      (moving.occupancy == PAWN && move.from.x != move.to.x);
+    bool legal;
+    if (capture) {
+      legal = atomic_capture_legal<Us>(move);
+    } else if (moving.occupancy == KING) {
+      legal = true; // Already tested by add_king_moves
+    } else {
+      const uint64_t to_bit = 1ULL << (move.to.y * 8 + move.to.x);
+      legal = (quiet_mask & to_bit) &&
+        (!(quiet_pinned >> (move.from.y * 8 + move.from.x) & 1) ||
+         (pin_ray(move.from.x, move.from.y) & to_bit));
+    }
+    if (legal)
+      possible_moves[num_legal++] = move;
+  }
+  possible_moves.resize(num_legal);
 }
 
 void BoardState::add_piece(int x, int y, Square& sq)
 {
-  board[y][x] = sq;
-  ttable->zobrist_xor_piece(zobrist_hash,
-    static_cast<PieceType>(!sq.colour * 6 + sq.occupancy), x, y);
-  material[sq.colour][sq.occupancy]++;
+  add_piece(x, y, sq.occupancy, sq.colour);
 }
 
 void BoardState::add_piece(int x, int y, Piece piece, PieceColour colour)
 {
   board[y][x].occupancy = piece;
   board[y][x].colour = colour;
-  ttable->zobrist_xor_piece(zobrist_hash,
-    static_cast<PieceType>(!colour * 6 + piece - 1), x, y);
+  const PieceType piece_type = static_cast<PieceType>(!colour * 6 + piece);
+  zobrist_xor_piece(zobrist_hash, piece_type, x, y);
+  if (piece == PAWN)
+    zobrist_xor_piece(pawn_hash, piece_type, x, y);
   material[colour][piece]++;
+  if (piece == KING)
+    king_squares[colour] = y * 8 + x;
+  if (nnue_active()) {
+    if (piece == KING)
+      accumulator.dirty[colour] = true;
+    else
+      nnue_add_piece(accumulator, piece, colour, y * 8 + x);
+  }
 }
 
 void BoardState::remove_piece(int x, int y)
 {
-  ttable->zobrist_xor_piece(zobrist_hash, static_cast<PieceType>(
-      !board[y][x].colour * 6 + board[y][x].occupancy
-    ), x, y);
+  const PieceType piece_type = static_cast<PieceType>(
+    !board[y][x].colour * 6 + board[y][x].occupancy);
+  zobrist_xor_piece(zobrist_hash, piece_type, x, y);
+  if (board[y][x].occupancy == PAWN)
+    zobrist_xor_piece(pawn_hash, piece_type, x, y);
   material[board[y][x].colour][board[y][x].occupancy]--;
+  if (nnue_active()) {
+    if (board[y][x].occupancy == KING)
+      accumulator.dirty[board[y][x].colour] = true;
+    else
+      nnue_remove_piece(accumulator, board[y][x].occupancy, board[y][x].colour, y * 8 + x);
+  }
   board[y][x].occupancy = NONE;
 }
 
+// Rebuilds the halves of the accumulator invalidated by a king move
+void BoardState::refresh_accumulator()
+{
+  for (int perspective = BLACK; perspective <= WHITE; perspective++) {
+    if (!accumulator.dirty[perspective])
+      continue;
+    for (int i = 0; i < 64; i++) {
+      const Square& sq = board[i / 8][i % 8];
+      if (sq.occupancy == KING && sq.colour == perspective) {
+        nnue_reset(accumulator, perspective, i);
+        break;
+      }
+    }
+    if (accumulator.dirty[perspective])
+      continue;
+    for (int i = 0; i < 64; i++) {
+      const Square& sq = board[i / 8][i % 8];
+      if (sq.occupancy != NONE && sq.occupancy != KING)
+        nnue_add_feature(accumulator, perspective, sq.occupancy, sq.colour, i);
+    }
+  }
+}
+
+static const uint64_t file_a_mask = 0x0101010101010101ULL;
+
+// Squares strictly in front of rank y from the point of view of colour
+static uint64_t forward_ranks_mask(PieceColour colour, int y)
+{
+  if (colour == WHITE)
+    return y == 7 ? 0 : ~0ULL << (8 * (y + 1));
+  return (1ULL << (8 * y)) - 1;
+}
+
+static uint64_t adjacent_files_mask(int x)
+{
+  return (x > 0 ? file_a_mask << (x - 1) : 0) |
+    (x < 7 ? file_a_mask << (x + 1) : 0);
+}
+
+int evaluate_pawn_structure(const uint64_t pawns[2])
+{
+  static const int passed_pawn_bonus[] = { 0, 5, 10, 20, 35, 60, 100, 0 };
+  static const int doubled_pawn_penalty = 10;
+  static const int isolated_pawn_penalty = 15;
+  static const int backward_pawn_penalty = 10;
+  int score[2] = { 0 };
+  for (int c = BLACK; c <= WHITE; c++) {
+    const PieceColour colour = static_cast<PieceColour>(c);
+    const uint64_t own = pawns[colour];
+    const uint64_t enemy = pawns[!colour];
+    const int forwards = colour == WHITE ? 1 : -1;
+    for (int x = 0; x < 8; x++) {
+      if (!(own & (file_a_mask << x)))
+        continue;
+      int pawns_on_file = 0;
+      const bool isolated = !(own & adjacent_files_mask(x));
+      for (int y = 1; y < 7; y++) {
+        if (!(own & (1ULL << (y * 8 + x))))
+          continue;
+        pawns_on_file++;
+
+        const uint64_t front_span = forward_ranks_mask(colour, y);
+        if (!(enemy & front_span & (adjacent_files_mask(x) | file_a_mask << x)))
+          score[colour] += passed_pawn_bonus[colour == WHITE ? y : 7 - y];
+
+        if (isolated) {
+          score[colour] -= isolated_pawn_penalty;
+        } else if (!(own & adjacent_files_mask(x) &
+                     ~forward_ranks_mask(colour, y))) {
+          // No neighbour level with or behind this pawn can defend its
+          // advance, so it's backward if an enemy pawn guards the stop square
+          const int stop_y = y + forwards;
+          const int guard_y = stop_y + forwards;
+          if (guard_y >= 0 && guard_y < 8 &&
+              enemy & adjacent_files_mask(x) & (0xFFULL << (8 * guard_y)))
+            score[colour] -= backward_pawn_penalty;
+        }
+      }
+      score[colour] -= doubled_pawn_penalty * (pawns_on_file - 1);
+    }
+  }
+  return score[WHITE] - score[BLACK];
+}
+
+template <Variant V>
 int BoardState::evaluate()
 {
-  static const int piece_values[] = { 100, 300, 300, 500, 900, 20000 };
+  // Per piece next to an atomic king that the opponent can capture
+  static const int exploding_king_penalty = 150;
+  // By a king's distance in moves from the centre
+  static const int hill_distance_bonus[] = { 0, 60, 25, 0 };
+  // For a king one free step from the centre when it isn't its turn
+  static const int hill_threat_bonus = 150;
+
+  // An exploded king has lost, whatever else is on the board
+  if (V == VARIANT_ATOMIC && !(material[WHITE][KING] && material[BLACK][KING]))
+    return material[WHITE][KING] ? INT16_MAX : INT16_MIN;
+
   int score[2] = { 0 };
+  if (V == VARIANT_HILL) {
+    if (king_on_hill(WHITE) || king_on_hill(BLACK))
+      return king_on_hill(WHITE) ? INT16_MAX : INT16_MIN;
+    // Stepping onto the centre is a legal move, so the side to move wins
+    // outright. The other side's threat has to be answered.
+    const PieceColour mover = whites_turn ? WHITE : BLACK;
+    if (hill_step_available(mover))
+      return mover == WHITE ? INT16_MAX : INT16_MIN;
+    if (hill_step_available(static_cast<PieceColour>(!mover)))
+      score[!mover] += hill_threat_bonus;
+  }
+
+  // Known endings are scored by material signature, unless the game
+  // is already over
+  if (endgame_reached && V == VARIANT_NONE &&
+      !(moves_enumerated && possible_moves.size() == 0)) {
+    int endgame_score;
+    if (evaluate_endgame(board, material, whites_turn, endgame_score))
+      return endgame_score;
+  }
+
+  if (V == VARIANT_NONE && nnue_loaded() && !accumulator.dirty[BLACK] && !accumulator.dirty[WHITE] &&
+      !(moves_enumerated && possible_moves.size() == 0)) {
+    const int score = nnue_evaluate(accumulator, whites_turn);
+    return whites_turn ? score : -score;
+  }
+
+  uint64_t pawns[2] = { 0 };
   for (int y = 0; y < 8; y++) {
     for (int x = 0; x < 8; x++) {
       if (board[y][x].occupancy == NONE)
         continue;
 
+      if (board[y][x].occupancy == PAWN)
+        pawns[board[y][x].colour] |= 1ULL << (y * 8 + x);
+
       score[board[y][x].colour] += piece_values[board[y][x].occupancy];
       score[board[y][x].colour] +=
         psts[board[y][x].occupancy][(board[y][x].colour == WHITE ? 7 - y : y) * 8 + x];
@@ -490,22 +1192,23 @@ int BoardState::evaluate()
       if (board[y][x].occupancy == KING) {
         if (moves_enumerated && possible_moves.size() == 0 &&
           (board[y][x].colour == WHITE) == whites_turn) {
-          if (!king_in_check(x, y))
+          if (!king_attacked<V>(x, y, whites_turn ? BLACK : WHITE))
             // stalemate
             return 0;
           // checkmate
           return board[y][x].colour == WHITE ? INT16_MIN : INT16_MAX;
         }
-        if (variant == VARIANT_HILL && x >= 3 && x <= 4 && y >= 3 && y <= 4) {
-          return board[y][x].colour == WHITE ? INT16_MAX : INT16_MIN;
-        }
+        if (V == VARIANT_HILL)
+          score[board[y][x].colour] += hill_distance_bonus[attack_tables.hill_distance[y * 8 + x]];
+        if (V == VARIANT_ATOMIC)
+          score[board[y][x].colour] -= exploding_king_penalty * exploding_king_danger(x, y);
         if (!endgame_reached) {// King safety
           const int forwards = board[y][x].colour * 2 - 1;
           int i = 1;
           while (i <= 2 && within_bounds(x, y + forwards * i)) {
             if (board[y + forwards * i][x].occupancy == PAWN &&
               board[y + forwards * i][x].colour == board[y][x].colour) {
-              score[board[y][x].colour] += 50;
+              score[board[y][x].colour] += king_shelter_bonus;
               break;
             }
             i++;
@@ -517,15 +1220,41 @@ int BoardState::evaluate()
   for (int i = 0; i < 2; i++) {
     if (material[i][BISHOP] == 2)
       // has a bishop pair
-      score[i] += 20;
+      score[i] += bishop_pair_bonus;
+  }
+  int pawn_score;
+  if (!pawn_table.search(pawn_hash, pawn_score)) {
+    pawn_score = evaluate_pawn_structure(pawns);
+    pawn_table.add(pawn_hash, pawn_score);
+  }
+  return score[WHITE] - score[BLACK] + pawn_score;
+}
+
+int BoardState::Evaluate()
+{
+  switch (variant) {
+  case VARIANT_ATOMIC:
+    return Evaluate<VARIANT_ATOMIC>();
+  case VARIANT_HILL:
+    return Evaluate<VARIANT_HILL>();
+  default:
+    return Evaluate<VARIANT_NONE>();
   }
-  return score[WHITE] - score[BLACK];
 }
 
+template <Variant V>
 int BoardState::Evaluate()
 {
   if (!evaluated) {
-    eval = evaluate();
+    TRACE_SAMPLED_SCOPE("evaluation", 1024);
+    if (moves_enumerated && possible_moves.size() == 0) {
+      // Mate and stalemate scores depend on the moves having been
+      // enumerated, so can't be shared with other copies of this position
+      eval = evaluate<V>();
+    } else if (!eval_cache.search(zobrist_hash, eval)) {
+      eval = evaluate<V>();
+      eval_cache.add(zobrist_hash, eval);
+    }
     evaluated = true;
   }
   return eval;
@@ -536,109 +1265,369 @@ void BoardState::UpdateEval(int score)
   eval = score;
 }
 
+template <Variant V>
 static bool sort_fn(BoardState& a, BoardState& b)
 {
   return a.whites_turn
-    ? a.Evaluate() < b.Evaluate()
-    : a.Evaluate() > b.Evaluate();
+    ? a.Evaluate<V>() < b.Evaluate<V>()
+    : a.Evaluate<V>() > b.Evaluate<V>();
+}
+
+// Tablebase results are only reliable right after a capture or pawn move,
+// since the 50-move count isn't tracked, and probing there is also cheapest
+static bool last_move_zeroing(const BoardState& state)
+{
+  const BoardState* prev = state.previous_state;
+  if (!prev)
+    return false;
+  if (state.pawn_hash != prev->pawn_hash)
+    return true;
+  for (int c = BLACK; c <= WHITE; c++) {
+    for (int piece = KNIGHT; piece <= QUEEN; piece++) {
+      if (state.piece_count(static_cast<PieceColour>(c), static_cast<Piece>(piece)) !=
+          prev->piece_count(static_cast<PieceColour>(c), static_cast<Piece>(piece)))
+        return true;
+    }
+  }
+  return false;
 }
 
-static int negamax(BoardState& state, int depth, int alpha, int beta, int colour)
+static int wdl_to_score(WDLScore wdl)
 {
+  static const int tablebase_win = 8000;
+  switch (wdl) {
+  case WDL_WIN:
+    return tablebase_win;
+  case WDL_LOSS:
+    return -tablebase_win;
+  default:
+    // Cursed wins and blessed losses are draws under the 50-move rule
+    return wdl;
+  }
+}
+
+template <Variant V>
+static int negamax(SearchContext& context, BoardState& state, int depth, int alpha, int beta, int colour)
+{
+  if (context.stopped())
+    return 0;
   int original_alpha = alpha;
+  context.nodes++;
+  context.iteration->nodes++;
+
+  // A king that has just reached the centre ends the game, so there's
+  // nothing to look up or search
+  if (V == VARIANT_HILL && state.king_on_hill(state.whites_turn ? BLACK : WHITE)) {
+    context.iteration->leaf_nodes++;
+    return (state.whites_turn ? INT16_MIN : INT16_MAX) * colour;
+  }
 
-  TableEntry *entry;
-  if (ttable->search(state.zobrist_hash, depth, &entry)) {
-    switch (entry->flag) {
+  TableEntry entry;
+  context.iteration->tt_probes++;
+  if (context.table.search(state.zobrist_hash, depth, entry)) {
+    context.iteration->tt_hits++;
+    switch (entry.flag) {
     case FLAG_EXACT:
-      return entry->eval;
+      context.iteration->tt_cutoffs++;
+      return entry.eval;
     case FLAG_LOWER_BOUND:
-      alpha = max(alpha, entry->eval);
+      alpha = max(alpha, entry.eval);
       break;
     case FLAG_UPPER_BOUND:
-      beta = min(beta, entry->eval);
+      beta = min(beta, entry.eval);
       break;
     }
-    if (alpha >= beta)
-      return entry->eval;
+    if (alpha >= beta) {
+      context.iteration->tt_cutoffs++;
+      return entry.eval;
+    }
+  }
+
+  WDLScore wdl;
+  if (V == VARIANT_NONE && syzygy_max_pieces() &&
+      last_move_zeroing(state) && syzygy_probe_wdl(state, wdl)) {
+    context.tablebase_hits++;
+    const int value = wdl_to_score(wdl);
+    context.table.add(state.zobrist_hash, depth, value, FLAG_EXACT, no_best_move);
+    return value;
   }
+
   const int num_moves = state.possible_moves.size();
-  if (depth == 0 || num_moves == 0)
-    return state.Evaluate() * colour;
+  if (depth == 0 || num_moves == 0) {
+    context.iteration->leaf_nodes++;
+    return state.Evaluate<V>() * colour;
+  }
 
   vector<BoardState> trial_states;
   trial_states.reserve(num_moves);
+  context.positions += num_moves;
   for (int move_num = 0; move_num < num_moves; move_num++) {
-    trial_states.emplace_back(&state, &state.possible_moves[move_num], depth > 1);
+    trial_states.emplace_back(VariantTag<V>(), &state, &state.possible_moves[move_num], depth > 1);
   }
 
   // Sorting again towards the end of the search gives little reordering,
   // and stops being worth the cost of sorting
   if (depth > 2)
-    sort(trial_states.begin(), trial_states.end(), sort_fn);
+    sort(trial_states.begin(), trial_states.end(), sort_fn<V>);
 
   int value = INT_MIN;
+  int best_move = no_best_move;
   for (int i = 0; i < num_moves; i++) {
-    value = max(value, -negamax(trial_states[i], depth - 1, -beta, -alpha, -colour));
+    const int score = -negamax<V>(context, trial_states[i], depth - 1, -beta, -alpha, -colour);
+    if (score > value) {
+      value = score;
+      best_move = static_cast<int>(trial_states[i].previous_move - state.possible_moves.data());
+    }
     alpha = max(value, alpha);
-    if (alpha >= beta)
+    if (alpha >= beta) {
+      context.iteration->beta_cutoffs++;
+      if (i == 0)
+        context.iteration->first_move_cutoffs++;
       break;
+    }
   }
 
-  ttable->add(state.zobrist_hash, depth, value,
-    value <= original_alpha ? FLAG_UPPER_BOUND : value >= beta ? FLAG_LOWER_BOUND : FLAG_EXACT);
+  // Scores from an abandoned search are meaningless
+  if (context.stopped())
+    return 0;
+
+  context.table.add(state.zobrist_hash, depth, value,
+    value <= original_alpha ? FLAG_UPPER_BOUND : value >= beta ? FLAG_LOWER_BOUND : FLAG_EXACT,
+    static_cast<uint8_t>(best_move));
   return value;
 }
 
-const Move* BoardState::find_best_move()
+// Follows the best moves stored in the transposition table on from a root
+// move, until the table runs out or the line reaches max_length
+static void principal_variation(const TranspositionTable& table, const BoardState& after_root_move,
+  int max_length, vector<string>& pv)
 {
+  string str;
+  move_to_string(after_root_move.previous_state, after_root_move.previous_move, str);
+  pv.push_back(str);
+
+  // The states are kept because each one points to the one before
+  list<BoardState> line;
+  const BoardState* state = &after_root_move;
+  TableEntry entry;
+  while (static_cast<int>(pv.size()) < max_length &&
+      table.search(state->zobrist_hash, 0, entry) &&
+      entry.best_move < state->possible_moves.size()) {
+    const Move* move = &state->possible_moves[entry.best_move];
+    str.clear();
+    move_to_string(state, move, str);
+    pv.push_back(str);
+    line.emplace_back(state, move);
+    state = &line.back();
+  }
+}
+
+static void print_principal_variations(const IterationStats& it)
+{
+  cout << "Depth " << it.depth << "\n";
+  for (size_t i = 0; i < it.lines.size(); i++) {
+    cout << "  " << i + 1 << ". (" << it.lines[i].score << ")";
+    for (const string& move : it.lines[i].moves)
+      cout << " " << move;
+    cout << "\n";
+  }
+}
+
+const Move* BoardState::search(SearchContext& context, int& score)
+{
+  switch (variant) {
+  case VARIANT_ATOMIC:
+    return search<VARIANT_ATOMIC>(context, score);
+  case VARIANT_HILL:
+    return search<VARIANT_HILL>(context, score);
+  default:
+    return search<VARIANT_NONE>(context, score);
+  }
+}
+
+template <Variant V>
+const Move* BoardState::search(SearchContext& context, int& score)
+{
+  const SearchLimits& limits = context.limits;
+  SearchStats& stats = context.stats;
   const int num_moves = possible_moves.size();
   const Move *best_move = &possible_moves[0];
   int best_score = INT_MIN;
   int search_depth = 0;
   Timer timer;
-  positions_checked = 0;
+  context.nodes = 0;
+  context.positions = 0;
+  context.tablebase_hits = 0;
+  stats.clear();
 
   vector<BoardState> trial_states;
   trial_states.reserve(num_moves);
+  context.positions += num_moves;
   for (int move_num = 0; move_num < num_moves; move_num++) {
-    trial_states.emplace_back(this, &possible_moves[move_num]);
+    trial_states.emplace_back(VariantTag<V>(), this, &possible_moves[move_num]);
   }
 
-  while (timer.elapsed() < 5.0) {
+  while (timer.elapsed() < limits.seconds && (!limits.depth || search_depth < limits.depth)) {
     const Move *best_move_this_iter = best_move;
     int best_score_this_iter = INT_MIN;
     int alpha = INT16_MIN, beta = INT16_MAX;
+    const double iteration_start = timer.elapsed();
+    const uint64_t positions_before = context.positions;
+    const uint64_t tablebase_hits_before = context.tablebase_hits;
+    stats.iterations.emplace_back(search_depth + 1);
+    IterationStats& iteration = stats.iterations.back();
+    context.iteration = &iteration;
+    // Best scores so far, best first. Alpha is held at the worst of the
+    // top multi_pv so that each of them is searched to an exact score.
+    vector<pair<int, int>> top_moves;
+    TRACE_SCOPE_ARG("iteration", "depth", to_string(search_depth + 1));
 
-    sort(trial_states.begin(), trial_states.end(), sort_fn);
+    sort(trial_states.begin(), trial_states.end(), sort_fn<V>);
 
     for (int move_num = 0; move_num < num_moves; move_num++) {
-      int score = -negamax(trial_states[move_num], search_depth, -beta, -alpha, whites_turn ? -1 : 1);
-      alpha = max(score, alpha);
+#ifdef CHESS_TRACE
+      string trace_move;
+      move_to_string(this, trial_states[move_num].previous_move, trace_move);
+#endif
+      TRACE_SCOPE_ARG("root move", "move", trace_move);
+      int score = -negamax<V>(context, trial_states[move_num], search_depth, -beta, -alpha, whites_turn ? -1 : 1);
+      if (context.stopped())
+        break;
+      auto insert_at = top_moves.begin();
+      while (insert_at != top_moves.end() && insert_at->first >= score)
+        insert_at++;
+      top_moves.emplace(insert_at, score, move_num);
+      if (static_cast<int>(top_moves.size()) > limits.multi_pv)
+        top_moves.pop_back();
+      if (static_cast<int>(top_moves.size()) == limits.multi_pv)
+        alpha = max(top_moves.back().first, alpha);
       trial_states[move_num].UpdateEval(whites_turn ? score : -score);
       if (score > best_score_this_iter) {
         best_score_this_iter = score;
         best_move_this_iter = trial_states[move_num].previous_move;
       }
     }
+    if (context.stopped()) {
+      context.iteration = nullptr;
+      stats.iterations.pop_back();
+      break;
+    }
     best_move = best_move_this_iter;
     best_score = best_score_this_iter;
+    iteration.best_score = best_score;
+    iteration.positions = context.positions - positions_before;
+    iteration.tablebase_hits = context.tablebase_hits - tablebase_hits_before;
+    iteration.seconds = timer.elapsed() - iteration_start;
+
+    for (const pair<int, int>& top_move : top_moves) {
+      iteration.lines.emplace_back();
+      PrincipalVariation& line = iteration.lines.back();
+      line.score = top_move.first;
+      principal_variation(context.table, trial_states[top_move.second], search_depth + 1, line.moves);
+    }
+    if (limits.on_iteration)
+      limits.on_iteration(iteration);
 
     if (best_score > 9000 || best_score < -9000)
       break;
     search_depth++;
   }
 
-  cout << "Evaluated to search depth " << search_depth << " in " <<
-    timer.elapsed() << " seconds\n";
-  cout << "Checked " << positions_checked << " positions in total\n";
+  stats.seconds = timer.elapsed();
+  score = best_score;
+  return best_move;
+}
+
+// The variant is settled here once, so the whole search below runs on code
+// specialised for it
+const Move* BoardState::find_best_move(SearchContext& context,
+  const function<void(const IterationStats&)>& on_iteration)
+{
+  switch (variant) {
+  case VARIANT_ATOMIC:
+    return find_best_move<VARIANT_ATOMIC>(context, on_iteration);
+  case VARIANT_HILL:
+    return find_best_move<VARIANT_HILL>(context, on_iteration);
+  default:
+    return find_best_move<VARIANT_NONE>(context, on_iteration);
+  }
+}
+
+template <Variant V>
+const Move* BoardState::find_best_move(SearchContext& context,
+  const function<void(const IterationStats&)>& on_iteration)
+{
+  if (V == VARIANT_NONE) {
+    const Move* book_move = book->probe(*this, book_selection);
+    if (book_move) {
+      string str;
+      move_to_string(this, book_move, str);
+      cout << "Book move " << str << "\n";
+      return book_move;
+    }
+  }
+
+  const Move* tablebase_move;
+  WDLScore wdl;
+  if (V == VARIANT_NONE && syzygy_probe_root(*this, tablebase_move, wdl)) {
+    static const char* wdl_names[] = {
+      "loss", "blessed loss", "draw", "cursed win", "win",
+    };
+    string str;
+    move_to_string(this, tablebase_move, str);
+    cout << "Tablebase move " << str << " keeps the " << wdl_names[wdl + 2] << "\n";
+    return tablebase_move;
+  }
+
+  // Only the caller's stop flag carries over from the last search
+  SearchLimits& limits = context.limits;
+  const atomic<bool>* stop = limits.stop;
+  limits = SearchLimits();
+  const bool timed = !pondering && !depth_limit && !node_limit;
+  limits.seconds = timed ? think_time : numeric_limits<double>::infinity();
+  limits.depth = depth_limit;
+  limits.nodes = node_limit;
+  limits.multi_pv = multi_pv;
+  limits.stop = stop;
+  limits.on_iteration = [on_iteration](const IterationStats& it) {
+    if (multi_pv > 1)
+      print_principal_variations(it);
+    if (on_iteration)
+      on_iteration(it);
+  };
+  int best_score;
+  const Move* best_move = search<V>(context, best_score);
+  SearchStats& stats = context.stats;
+
+  // Nobody is waiting for the result of an abandoned search
+  if (context.abandoned())
+    return nullptr;
+
+  cout << "Evaluated to search depth " << stats.iterations.size() << " in " <<
+    stats.seconds << " seconds\n";
+  cout << "Checked " << context.positions << " positions in total, searching " <<
+    context.nodes << " nodes\n";
+  if (context.tablebase_hits)
+    cout << "Tablebase hits: " << context.tablebase_hits << "\n";
   string str;
   move_to_string(this, best_move, str);
   cout << "Best move " << str << " has score " << best_score << "\n";
 
-  ttable->clear();
+  stats.best_move = str;
+  if (!search_stats_file.empty()) {
+    ofstream out(search_stats_file, ios::app);
+    stats.write_json(out);
+  }
+
+  // Pondering needs the table to find the expected reply, and a ponder
+  // search builds on it
+  if (!ponder_enabled) {
+    TRACE_SCOPE("transposition table clear");
+    context.table.clear();
+  }
 
-  if (variant == VARIANT_NONE && best_score <= -1000) {
+  // A search told to move before its first iteration has no score to go on
+  if (V == VARIANT_NONE && !stats.iterations.empty() && best_score <= -1000) {
     cout << "Resigns\n";
     return nullptr;
   }
@@ -646,52 +1635,466 @@ const Move* BoardState::find_best_move()
   return best_move;
 }
 
-int main()
+// Options are given on the command line as Name=value
+static void set_option(const string& name, const string& value)
+{
+  if (name == "SyzygyPath") {
+    syzygy_init(value);
+    if (!syzygy_max_pieces()) {
+      cout << "No tablebases found in " << value << "\n";
+    } else if (verify_syzygy_tables(syzygy_samples)) {
+      syzygy_init("");
+      cout << "Tablebases in " << value << " failed to read back, so they won't be used\n";
+    } else {
+      cout << "Found tablebases of up to " << syzygy_max_pieces() << " pieces\n";
+    }
+  } else if (name == "SyzygyCheck") {
+    if (value == "on")
+      syzygy_check = true;
+    else if (value == "off")
+      syzygy_check = false;
+    else
+      cout << "SyzygyCheck must be on or off\n";
+  } else if (name == "EvalFile") {
+    if (nnue_init(value))
+      cout << "Loaded network " << value << "\n";
+    else
+      cout << "Failed to load network " << value << ", using classical evaluation\n";
+  } else if (name == "SearchStatsFile") {
+    search_stats_file = value;
+  } else if (name == "TraceFile") {
+    if (!trace_open(value))
+      cout << "Tracing is unavailable; build with CHESS_TRACE and check " << value << " is writable\n";
+  } else if (name == "Hash") {
+    ttable->resize(max(1, atoi(value.c_str())));
+  } else if (name == "Threads") {
+    num_threads = max(1, atoi(value.c_str()));
+  } else if (name == "AnalysisServer") {
+    server_port = atoi(value.c_str());
+  } else if (name == "LoadTest") {
+    load_test_port = atoi(value.c_str());
+  } else if (name == "LoadConnections") {
+    load_connections = max(1, atoi(value.c_str()));
+  } else if (name == "LoadRequests") {
+    load_requests = max(1, atoi(value.c_str()));
+  } else if (name == "LoadDepth") {
+    load_depth = max(1, atoi(value.c_str()));
+  } else if (name == "ReplayPgn") {
+    replay_files.push_back(value);
+  } else if (name == "SelfPlay") {
+    self_play.path = value;
+  } else if (name == "SelfPlayGames") {
+    self_play.games = max(1LL, atoll(value.c_str()));
+  } else if (name == "SelfPlayRandomPlies") {
+    self_play.random_plies = max(0, atoi(value.c_str()));
+  } else if (name == "SelfPlaySeed") {
+    self_play.seed = strtoull(value.c_str(), nullptr, 10);
+  } else if (name == "Tune") {
+    tuner.path = value;
+  } else if (name == "TuneOutput") {
+    tuner.output = value;
+  } else if (name == "TuneEpochs") {
+    tuner.epochs = max(1, atoi(value.c_str()));
+  } else if (name == "TuneLearningRate") {
+    tuner.learning_rate = max(0.0, atof(value.c_str()));
+  } else if (name == "Depth") {
+    depth_limit = max(0, atoi(value.c_str()));
+  } else if (name == "Nodes") {
+    node_limit = max(0LL, atoll(value.c_str()));
+  } else if (name == "MultiPV") {
+    multi_pv = max(1, atoi(value.c_str()));
+  } else if (name == "Ponder") {
+    if (value == "on")
+      ponder_enabled = true;
+    else if (value == "off")
+      ponder_enabled = false;
+    else
+      cout << "Ponder must be on or off\n";
+  } else if (name == "BookFile") {
+    if (!book->open(value))
+      cout << "Failed to open book " << value << "\n";
+  } else if (name == "BookSelection") {
+    if (value == "best")
+      book_selection = BOOK_BEST;
+    else if (value == "weighted")
+      book_selection = BOOK_WEIGHTED;
+    else
+      cout << "BookSelection must be best or weighted\n";
+  } else {
+    cout << "Unknown option " << name << "\n";
+  }
+}
+
+// Runs find_best_move() on a thread of its own, so that the console can
+// still be read while the engine thinks. The best line of the last
+// completed iteration can be read from any thread.
+//
+// The thread lives as long as the object and waits for each position in
+// turn, so its evaluation and pawn caches carry over from one search to
+// the next. Its stop flags are its own, so stopping one search leaves any
+// other alone.
+class BackgroundSearch {
+public:
+  explicit BackgroundSearch(TranspositionTable& table);
+  ~BackgroundSearch();
+  // The position must outlive the search
+  void start(BoardState& state);
+  bool running() const { return searching; }
+  bool finished() const { return done; }
+  // Cuts the search short. It still moves, with the best move of its last
+  // completed iteration.
+  void move_now() { stop_search = true; }
+  // Waits for the search to end and returns its move
+  const Move* join();
+  // Abandons the search
+  void stop();
+  // False until an iteration has completed
+  bool best_line(int& depth, PrincipalVariation& line) const;
+  TranspositionTable& table() { return context.table; }
+private:
+  void run();
+  SearchContext context;
+  // Set from the main thread to abandon a search part way through an
+  // iteration
+  atomic<bool> stop_search{ false };
+  // Set along with it when nobody wants the search's move any more
+  atomic<bool> abandon_search{ false };
+  // Started and not yet joined or stopped. Only used by the main thread.
+  bool searching = false;
+  atomic<bool> done{ false };
+  mutex request_mutex;
+  condition_variable request_changed;
+  BoardState* position = nullptr; // Waiting for the worker, or being searched
+  Variant position_variant = VARIANT_NONE;
+  bool quit = false;
+  const Move* result = nullptr;
+  mutable mutex line_mutex;
+  int line_depth = 0;
+  PrincipalVariation line;
+  // Last, so that everything it uses exists before it starts
+  thread worker;
+};
+
+BackgroundSearch::BackgroundSearch(TranspositionTable& table)
+  : context(table)
+  , worker(&BackgroundSearch::run, this)
+{
+  context.limits.stop = &stop_search;
+  context.abandon = &abandon_search;
+}
+
+BackgroundSearch::~BackgroundSearch()
+{
+  stop();
+  {
+    lock_guard<mutex> lock(request_mutex);
+    quit = true;
+  }
+  request_changed.notify_all();
+  worker.join();
+}
+
+void BackgroundSearch::run()
+{
+  unique_lock<mutex> lock(request_mutex);
+  while (true) {
+    request_changed.wait(lock, [this] { return position || quit; });
+    if (quit)
+      return;
+    BoardState& state = *position;
+    variant = position_variant;
+    lock.unlock();
+    const Move* move = state.find_best_move(context, [this](const IterationStats& it) {
+      lock_guard<mutex> lock(line_mutex);
+      line_depth = it.depth;
+      line = it.lines.front();
+    });
+    lock.lock();
+    result = move;
+    position = nullptr;
+    done = true;
+    request_changed.notify_all();
+  }
+}
+
+void BackgroundSearch::start(BoardState& state)
+{
+  stop();
+  line_depth = 0;
+  done = false;
+  searching = true;
+  {
+    lock_guard<mutex> lock(request_mutex);
+    position = &state;
+    position_variant = variant;
+  }
+  request_changed.notify_all();
+}
+
+const Move* BackgroundSearch::join()
+{
+  unique_lock<mutex> lock(request_mutex);
+  request_changed.wait(lock, [this] { return !position; });
+  searching = false;
+  stop_search = false;
+  return result;
+}
+
+void BackgroundSearch::stop()
+{
+  if (!searching)
+    return;
+  abandon_search = true;
+  stop_search = true;
+  join();
+  abandon_search = false;
+}
+
+bool BackgroundSearch::best_line(int& depth, PrincipalVariation& best) const
+{
+  lock_guard<mutex> lock(line_mutex);
+  depth = line_depth;
+  best = line;
+  return line_depth > 0;
+}
+
+// Searches the position after the opponent's expected reply while they
+// think. The position is kept in a list of its own so that on a ponder hit
+// it can be spliced onto the game, leaving the moves the search returns
+// pointing into it.
+class Ponderer {
+public:
+  explicit Ponderer(TranspositionTable& table) : search(table) {}
+  ~Ponderer() { stop(); }
+  bool start(const BoardState& state);
+  bool active() const { return search.running(); }
+  const Move* expected() const { return expected_reply; }
+  // Checks the opponent's move against the prediction. A miss abandons the
+  // search; a hit moves the predicted position onto the game and lets the
+  // search carry on for the normal thinking time.
+  bool resolve(const Move* user_move, list<BoardState>& game);
+  // After a hit, whether the search has finished or had its thinking time
+  bool ready() const;
+  // Returns the move of a search that is ready. An iteration still running
+  // is cut short rather than finished, as it may have started long before.
+  const Move* finish();
+  void stop();
+  BackgroundSearch& background() { return search; }
+private:
+  BackgroundSearch search;
+  list<BoardState> predicted;
+  const Move* expected_reply = nullptr;
+  double hit_time = 0;
+};
+
+bool Ponderer::start(const BoardState& state)
+{
+  TableEntry entry;
+  if (!ponder_enabled || !search.table().search(state.zobrist_hash, 0, entry) ||
+      entry.best_move >= state.possible_moves.size())
+    return false;
+  expected_reply = &state.possible_moves[entry.best_move];
+  predicted.clear();
+  predicted.emplace_back(&state, expected_reply);
+  if (predicted.back().possible_moves.empty())
+    return false;
+
+  string str;
+  move_to_string(&state, expected_reply, str);
+  cout << "Pondering on " << str << "\n";
+  pondering = true;
+  search.start(predicted.back());
+  return true;
+}
+
+bool Ponderer::resolve(const Move* user_move, list<BoardState>& game)
+{
+  if (!search.running())
+    return false;
+  if (user_move == expected_reply) {
+    hit_time = search_clock.elapsed();
+    pondering = false;
+    game.splice(game.end(), predicted);
+    return true;
+  }
+  stop();
+  return false;
+}
+
+bool Ponderer::ready() const
+{
+  // Fixed depth and node limits keep the engine off the clock
+  return search.finished() ||
+    (!depth_limit && !node_limit && search_clock.elapsed() - hit_time >= think_time);
+}
+
+const Move* Ponderer::finish()
+{
+  if (!search.finished())
+    search.move_now();
+  return search.join();
+}
+
+void Ponderer::stop()
+{
+  search.stop();
+  pondering = false;
+  predicted.clear();
+}
+
+// What became of a search the console was read through
+enum ThinkOutcome {
+  THINK_FINISHED, // Ready to move, perhaps early because the user asked
+  THINK_STOPPED,  // Abandoned, leaving the move to the user
+  THINK_UNDO,     // Abandoned, and the last move is to be taken back
+  THINK_QUIT,
+};
+
+static void print_best_line(const BackgroundSearch& search)
+{
+  int depth;
+  PrincipalVariation line;
+  if (!search.best_line(depth, line)) {
+    cout << "No iteration has finished yet\n";
+    return;
+  }
+  cout << "Depth " << depth << " (" << line.score << "):";
+  for (const string& move : line.moves)
+    cout << " " << move;
+  cout << "\n";
+}
+
+// Reads the console until the search is ready to move, answering what
+// can be answered while it thinks
+template <typename Ready>
+static ThinkOutcome think(Console& console, BackgroundSearch& search, Ready ready)
+{
+  string command;
+  while (!ready()) {
+    if (!console.read(command, chrono::milliseconds(10)))
+      continue;
+    if (command == "Now" || command == "now") {
+      search.move_now();
+    } else if (command == "Line" || command == "line" || command == "Hint" || command == "hint") {
+      print_best_line(search);
+    } else if (command == "Stop" || command == "stop") {
+      search.stop();
+      return THINK_STOPPED;
+    } else if (command == "Undo" || command == "undo") {
+      search.stop();
+      return THINK_UNDO;
+    } else if (command == "Exit" || command == "exit" || command == "Quit" || command == "quit") {
+      search.stop();
+      return THINK_QUIT;
+    } else {
+      cout << "Thinking. Enter now to move, line to see the best line, stop, undo or quit\n";
+    }
+  }
+  return THINK_FINISHED;
+}
+
+// Takes back the last count moves, if the game has that many
+static void take_back(list<BoardState>& game, size_t count)
+{
+  if (game.size() <= count) {
+    cout << "No moves to undo\n";
+    return;
+  }
+  for (size_t i = 0; i < count; i++)
+    game.pop_back();
+  cout << "\n";
+  print_board(game.back());
+}
+
+int main(int argc, char* argv[])
 {
   ttable = new TranspositionTable();
+  book = new PolyglotBook();
+  init_endgames();
+  for (int i = 1; i < argc; i++) {
+    const string arg = argv[i];
+    const size_t equals = arg.find('=');
+    set_option(arg.substr(0, equals),
+      equals == string::npos ? "" : arg.substr(equals + 1));
+  }
+  if (server_port)
+    return run_analysis_server(server_port, num_threads, *ttable);
+  if (load_test_port)
+    return run_load_test(load_test_port, load_connections, load_requests, load_depth);
+  if (!replay_files.empty()) {
+    run_pgn_replay(replay_files, num_threads);
+    return 0;
+  }
+  if (!self_play.path.empty()) {
+    self_play.num_threads = num_threads;
+    self_play.limits.seconds = numeric_limits<double>::infinity();
+    self_play.limits.depth = depth_limit;
+    self_play.limits.nodes = depth_limit || node_limit ? node_limit : self_play_nodes;
+    self_play.book = book;
+    return run_self_play(self_play);
+  }
+  if (!tuner.path.empty()) {
+    tuner.num_threads = num_threads;
+    return run_tuner(tuner);
+  }
+  if (syzygy_check)
+    return run_syzygy_check();
+  // Read on a thread of its own from here on, so the engine can think
+  // without holding up the user
+  Console* console = new Console();
   while (true) {
     string user_input;
     int num_players = 1;
     bool engine_plays_black = true;
     cout << "How many players? (0, 1, 2)\n";
-    cin >> user_input;
+    if (!console->read(user_input))
+      return 0;
     if (user_input == "0" || user_input == "2")
       num_players = atoi(user_input.c_str());
 
     if (num_players == 1) {
       cout << "Computer colour? (white, black)\n";
-      cin >> user_input;
+      if (!console->read(user_input))
+        return 0;
       if (user_input == "White" || user_input == "white")
         engine_plays_black = false;
     }
 
     cout << "Variant? (atomic, hill)\n";
-    cin >> user_input;
+    if (!console->read(user_input))
+      return 0;
+    // Anything else is standard chess, whatever the last game was
     if (user_input == "Atomic" || user_input == "atomic")
-      variant = VARIANT_ATOMIC;
-    if (user_input == "Hill" || user_input == "hill")
-      variant = VARIANT_HILL;
+      set_variant(VARIANT_ATOMIC);
+    else if (user_input == "Hill" || user_input == "hill")
+      set_variant(VARIANT_HILL);
+    else
+      set_variant(VARIANT_NONE);
 
     list<BoardState> game;
     game.emplace_back();
+    ttable->clear();
+    BackgroundSearch engine(*ttable);
+    Ponderer ponder(*ttable);
+    bool ponder_hit = false;
+    // Set when the user stops the engine, to make its move for it
+    bool user_takes_move = false;
 
     print_board(game.back());
 
     while (game.back().possible_moves.size()) {
-      if (num_players > 0 &&
-        !(game.size() == 1 && num_players == 1 && !engine_plays_black)) {
+      const bool users_turn = user_takes_move || num_players == 2 ||
+        (num_players == 1 && game.back().whites_turn == engine_plays_black);
+      if (users_turn) {
         cout << "Please enter your move\n";
-        cin >> user_input;
-        while (user_input == "Undo" || user_input == "undo") {
-          game.pop_back();
-          game.pop_back();
-          cout << "\n";
-          print_board(game.back());
-          cout << "Please enter your move\n";
-          cin >> user_input;
-        }
+        if (!console->read(user_input))
+          return 0;
         const Move *user_move = nullptr;
-        if (user_input == "Resign" || user_input == "resign" ||
+        if (user_input == "Undo" || user_input == "undo") {
+          ponder.stop();
+          take_back(game, 2);
+          continue;
+        } else if (user_input == "Resign" || user_input == "resign" ||
           user_input == "Retry" || user_input == "retry" ||
           user_input == "Restart" || user_input == "restart") {
           break;
@@ -705,29 +2108,84 @@ int main()
             cout << str << (i < game.back().possible_moves.size() - 1 ? ", " : ".");
           }
           cout << "\n";
+          continue;
+        } else if (user_input == "Mate" || user_input == "mate") {
+          const MateResult mate = solve_mate(game.back(), MateLimits());
+          if (mate.status == MATE_PROVEN) {
+            cout << "Forced win:";
+            for (const string& move : mate.line)
+              cout << " " << move;
+          } else {
+            cout << (mate.status == MATE_DISPROVEN ? "No forced win" : "No forced win found");
+          }
+          cout << " (" << mate.nodes << " positions)\n";
+          continue;
+        } else if (user_input == "Line" || user_input == "line") {
+          if (ponder.active()) {
+            string str;
+            move_to_string(&game.back(), ponder.expected(), str);
+            cout << "Expecting " << str << ", then\n";
+            print_best_line(ponder.background());
+          } else {
+            cout << "The engine isn't thinking\n";
+          }
+          continue;
         } else if (user_input == "Hint" || user_input == "hint") {
-          const Move* best_move = game.back().find_best_move();
-          if (!best_move)
-            break;
-          game.emplace_back(&game.back(), best_move);
-          print_board(game.back());
-        } else if (parse_move_string(game.back(), user_input, user_move)) {
-          game.emplace_back(&game.back(), user_move);
-          cout << "\n";
-          print_board(game.back());
-        } else {
+          // A ponder search has already picked the move it expects
+          if (ponder.active()) {
+            user_move = ponder.expected();
+          } else {
+            engine.start(game.back());
+            const ThinkOutcome outcome = think(*console, engine, [&] { return engine.finished(); });
+            if (outcome == THINK_QUIT)
+              return 0;
+            if (outcome == THINK_UNDO)
+              take_back(game, 2);
+            if (outcome != THINK_FINISHED)
+              continue;
+            user_move = engine.join();
+            if (!user_move)
+              break;
+          }
+        } else if (!parse_move_string(game.back(), user_input, user_move)) {
           cout << "Failed to find a legal move matching that instruction\n";
           continue;
         }
-      }
 
-      if (num_players < 2) {
-        const Move* best_move = game.back().find_best_move();
-        if (!best_move)
-          break;
-        game.emplace_back(&game.back(), best_move);
+        user_takes_move = false;
+        ponder_hit = ponder.resolve(user_move, game);
+        if (!ponder_hit)
+          game.emplace_back(&game.back(), user_move);
+        cout << "\n";
         print_board(game.back());
+        continue;
+      }
+
+      // After a ponder hit the search is already under way
+      if (!ponder_hit)
+        engine.start(game.back());
+      BackgroundSearch& search = ponder_hit ? ponder.background() : engine;
+      const ThinkOutcome outcome = think(*console, search,
+        [&] { return ponder_hit ? ponder.ready() : engine.finished(); });
+      const Move* best_move = nullptr;
+      if (outcome == THINK_FINISHED)
+        best_move = ponder_hit ? ponder.finish() : engine.join();
+      ponder_hit = false;
+      if (outcome == THINK_QUIT)
+        return 0;
+      if (outcome != THINK_FINISHED) {
+        ponder.stop();
+        user_takes_move = true;
+        if (outcome == THINK_UNDO)
+          take_back(game, 1);
+        continue;
       }
+      if (!best_move)
+        break;
+      game.emplace_back(&game.back(), best_move);
+      print_board(game.back());
+      if (num_players == 1)
+        ponder.start(game.back());
     }
   }
 }
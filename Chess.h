@@ -1,7 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
 #include <vector>
 
+#include "Nnue.h"
+
 using namespace std;
 
 enum Piece {
@@ -25,6 +31,13 @@ enum Variant {
   VARIANT_HILL,
 };
 
+// Sets the variant of the positions made on the calling thread
+void set_variant(Variant v);
+
+// The classical evaluation's pawn structure term, white's score minus
+// black's, from each colour's pawn bitboard
+int evaluate_pawn_structure(const uint64_t pawns[2]);
+
 class Square {
 public:
   Piece occupancy;
@@ -69,42 +82,140 @@ public:
 
 #define MOVE_HISTORY_LEN 12
 
+// Selects the variant-specialised constructor, so the search can make moves
+// without checking the variant at every node
+template <Variant V>
+class VariantTag {};
+
+class IterationStats;
+class SearchContext;
+
+// Bounds on a search started with BoardState::search(), and where its
+// progress goes. The search stops at whichever limit it reaches first.
+// Depth and node limits don't depend on the clock, so on one thread,
+// starting from the same table, they always give the same result.
+class SearchLimits {
+public:
+  double seconds = 5.0; // No iteration is started after this long
+  int depth = 0;        // Deepest iteration to run, or 0 for no limit
+  // Nodes to search, or 0 for no limit. Reaching it abandons the iteration
+  // in progress, as stop does.
+  uint64_t nodes = 0;
+  int multi_pv = 1;     // Root moves to search to an exact score
+  // Abandons the search part way through an iteration once set
+  const atomic<bool>* stop = nullptr;
+  // Called after every completed iteration
+  function<void(const IterationStats&)> on_iteration;
+};
+
 class BoardState {
 public:
   BoardState(void);
   BoardState(const BoardState *prev_state, const Move *move, bool enum_moves = true);
+  template <Variant V>
+  BoardState(VariantTag<V>, const BoardState *prev_state, const Move *move, bool enum_moves = true);
+  int Evaluate();
+  template <Variant V>
   int Evaluate();
   void UpdateEval(int score);
-  const Move* find_best_move();
+  bool load_fen(const string& fen);
+  // The engine's move, searched with the game's settings. Returns nullptr
+  // to resign, or if a ponder search is abandoned. on_iteration is called
+  // from the searching thread after every completed iteration.
+  const Move* find_best_move(SearchContext& context,
+    const function<void(const IterationStats&)>& on_iteration = nullptr);
+  // The search behind find_best_move(), without the book, the tablebases or
+  // any output. It runs within context.limits and leaves its statistics in
+  // context.stats.
+  const Move* search(SearchContext& context, int& score);
+  void EnumerateMoves();
+  bool in_check(PieceColour colour) const;
+  bool king_on_hill(PieceColour colour) const;
+  // Whether a position without legal moves is lost for the side to move,
+  // rather than drawn
+  bool side_to_move_lost() const;
+  bool any_castling_rights() const;
+  int piece_count(PieceColour colour, Piece piece) const;
+  bool in_endgame() const { return endgame_reached; }
+  // Whether evaluate() scores the position with its classical terms alone,
+  // as evaluate_batch() does: not over, in the standard variant, not a
+  // known ending and not left to a network
+  bool classical_evaluation() const;
+  bool has_castling_right(int right) const { return castling_rights[right]; }
+  const Coords& en_passant_square() const { return en_passant_available; }
   Square board[8][8];
   bool whites_turn;
   vector<Move> possible_moves;
   const BoardState* previous_state;
   const Move* previous_move;
   uint64_t zobrist_hash;
+  uint64_t pawn_hash;
 
 private:
+  BoardState(const BoardState *prev_state);
+  template <Variant V>
+  void make_move(const BoardState *prev_state, const Move *move, bool enum_moves);
+  template <Variant V>
+  const Move* find_best_move(SearchContext& context,
+    const function<void(const IterationStats&)>& on_iteration);
+  template <Variant V>
+  const Move* search(SearchContext& context, int& score);
+  template <PieceColour Us>
   bool can_move_to_space(int x, int y);
-  bool king_in_check(int x, int y);
+  bool square_attacked(int x, int y, PieceColour attacker, bool kings_attack = true) const;
+  template <Variant V>
+  bool king_attacked(int x, int y, PieceColour attacker) const;
+  int exploding_king_danger(int x, int y) const;
+  bool hill_step_available(PieceColour colour);
+  template <PieceColour Us>
+  int find_checks_and_pins();
+  uint64_t pin_ray(int x, int y) const;
+  template <Variant V, PieceColour Us>
+  bool en_passant_legal(int x, int y, int to_x);
+  template <PieceColour Us>
+  bool atomic_capture_legal(const Move& move);
+  template <PieceColour Us>
+  void remove_illegal_atomic_moves(uint64_t quiet_mask, uint64_t quiet_pinned);
   void add_move(Coords& from, Coords& to);
+  template <Variant V, PieceColour Us>
   void add_pawn_moves(int x, int y);
+  template <PieceColour Us>
   void add_knight_moves(int x, int y);
+  template <PieceColour Us>
   void add_bishop_moves(int x, int y);
+  template <PieceColour Us>
   void add_rook_moves(int x, int y);
+  template <Variant V, PieceColour Us>
   void add_king_moves(int x, int y);
   void enumerate_all_moves();
+  template <Variant V>
+  void enumerate_all_moves();
+  template <Variant V, PieceColour Us>
+  void enumerate_all_moves();
+  template <Variant V, PieceColour Us>
+  void enumerate_evasions();
+  template <Variant V>
   int evaluate();
 
   void add_piece(int x, int y, Square& sq);
   void add_piece(int x, int y, Piece piece, PieceColour colour);
   void remove_piece(int x, int y);
+  void refresh_accumulator();
 
   Coords en_passant_available;
   bool castling_rights[4];
   int material[2][6];
+  // y * 8 + x of each colour's king, kept up to date by add_piece(). Only
+  // meaningful while material[colour][KING] is non-zero.
+  int king_squares[2];
   bool moves_enumerated;
+  // Legality masks for the side to move, filled in by find_checks_and_pins
+  Coords king_square;
+  uint64_t check_mask;
+  uint64_t pinned;
   int eval;
   bool evaluated;
   bool endgame_reached;
-  int* psts[6];
+  const int* psts[6];
+  Accumulator accumulator;
 };
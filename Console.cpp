@@ -0,0 +1,45 @@
+#include <iostream>
+#include <thread>
+
+#include "Console.h"
+
+Console::Console()
+  : ended(false)
+{
+  thread([this] {
+    string word;
+    while (cin >> word) {
+      lock_guard<mutex> lock(words_mutex);
+      words.push_back(word);
+      words_changed.notify_one();
+    }
+    lock_guard<mutex> lock(words_mutex);
+    ended = true;
+    words_changed.notify_one();
+  }).detach();
+}
+
+bool Console::read(string& word)
+{
+  // Reading cin would flush cout, but that happens on the other thread
+  // before anything has been written
+  cout.flush();
+  unique_lock<mutex> lock(words_mutex);
+  words_changed.wait(lock, [this] { return !words.empty() || ended; });
+  if (words.empty())
+    return false;
+  word = words.front();
+  words.pop_front();
+  return true;
+}
+
+bool Console::read(string& word, chrono::milliseconds wait)
+{
+  cout.flush();
+  unique_lock<mutex> lock(words_mutex);
+  if (!words_changed.wait_for(lock, wait, [this] { return !words.empty(); }))
+    return false;
+  word = words.front();
+  words.pop_front();
+  return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+using namespace std;
+
+// Reads words from standard input on a thread of its own, so that the main
+// thread can keep an eye on a search while it waits for the user. The
+// thread blocks on the input for the rest of the program, so a console is
+// never destroyed.
+class Console {
+public:
+  Console();
+  Console(const Console&) = delete;
+  Console& operator=(const Console&) = delete;
+  // Waits for the next word. Returns false once the input has ended.
+  bool read(string& word);
+  // As read(), but also returns false if nothing arrives in time
+  bool read(string& word, chrono::milliseconds wait);
+private:
+  mutex words_mutex;
+  condition_variable words_changed;
+  deque<string> words;
+  bool ended;
+};
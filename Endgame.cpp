@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "Endgame.h"
+
+using namespace std;
+
+// KPK bitbase, indexed with white as the side with the pawn and the pawn
+// mirrored onto files a-d. One bit per position, set if white wins.
+constexpr int kpk_max_index = 2 * 24 * 64 * 64;
+static vector<bool> kpk_bitbase;
+
+enum KPKResult : uint8_t {
+  KPK_INVALID = 0,
+  KPK_UNKNOWN = 1,
+  KPK_DRAW = 2,
+  KPK_WIN = 4,
+};
+
+static int file_of(int sq) { return sq & 7; }
+static int rank_of(int sq) { return sq >> 3; }
+
+static int distance(int a, int b)
+{
+  return max(abs(file_of(a) - file_of(b)), abs(rank_of(a) - rank_of(b)));
+}
+
+static uint64_t king_attacks(int sq)
+{
+  uint64_t attacks = 0;
+  for (int dx = -1; dx <= 1; dx++) {
+    for (int dy = -1; dy <= 1; dy++) {
+      const int x = file_of(sq) + dx, y = rank_of(sq) + dy;
+      if ((dx || dy) && x >= 0 && x < 8 && y >= 0 && y < 8)
+        attacks |= 1ULL << (y * 8 + x);
+    }
+  }
+  return attacks;
+}
+
+static uint64_t white_pawn_attacks(int sq)
+{
+  uint64_t attacks = 0;
+  if (rank_of(sq) < 7) {
+    if (file_of(sq) > 0)
+      attacks |= 1ULL << (sq + 7);
+    if (file_of(sq) < 7)
+      attacks |= 1ULL << (sq + 9);
+  }
+  return attacks;
+}
+
+// Pawn squares are limited to files a-d and ranks 2-7
+static int kpk_index(bool white_to_move, int black_king, int white_king, int pawn)
+{
+  return white_king | (black_king << 6) | (white_to_move << 12) |
+    (file_of(pawn) << 13) | ((6 - rank_of(pawn)) << 15);
+}
+
+class KPKPosition {
+public:
+  void init(int idx)
+  {
+    white_king = idx & 63;
+    black_king = (idx >> 6) & 63;
+    white_to_move = (idx >> 12) & 1;
+    pawn = (6 - ((idx >> 15) & 7)) * 8 + ((idx >> 13) & 3);
+
+    if (distance(white_king, black_king) <= 1 ||
+        white_king == pawn || black_king == pawn ||
+        (white_to_move && (white_pawn_attacks(pawn) & (1ULL << black_king))))
+      result = KPK_INVALID;
+    // Promotes without the new queen being taken
+    else if (white_to_move && rank_of(pawn) == 6 &&
+             white_king != pawn + 8 &&
+             (distance(black_king, pawn + 8) > 1 ||
+              distance(white_king, pawn + 8) == 1))
+      result = KPK_WIN;
+    // Stalemated, or able to take an undefended pawn
+    else if (!white_to_move &&
+             (!(king_attacks(black_king) &
+                ~(king_attacks(white_king) | white_pawn_attacks(pawn))) ||
+              (king_attacks(black_king) & ~king_attacks(white_king) &
+               (1ULL << pawn))))
+      result = KPK_DRAW;
+    else
+      result = KPK_UNKNOWN;
+  }
+
+  KPKResult classify(const vector<KPKPosition>& db)
+  {
+    // White wins if any move wins, black draws if any move draws
+    const KPKResult good = white_to_move ? KPK_WIN : KPK_DRAW;
+    const KPKResult bad = white_to_move ? KPK_DRAW : KPK_WIN;
+    int r = KPK_INVALID;
+    uint64_t moves = king_attacks(white_to_move ? white_king : black_king);
+    for (int sq = 0; sq < 64; sq++) {
+      if (!(moves & (1ULL << sq)))
+        continue;
+      r |= white_to_move
+        ? db[kpk_index(false, black_king, sq, pawn)].result
+        : db[kpk_index(true, sq, white_king, pawn)].result;
+    }
+    if (white_to_move) {
+      if (rank_of(pawn) < 6)
+        r |= db[kpk_index(false, black_king, white_king, pawn + 8)].result;
+      if (rank_of(pawn) == 1 && pawn + 8 != white_king && pawn + 8 != black_king)
+        r |= db[kpk_index(false, black_king, white_king, pawn + 16)].result;
+    }
+    return result = r & good ? good : r & KPK_UNKNOWN ? KPK_UNKNOWN : bad;
+  }
+
+  KPKResult result;
+
+private:
+  int white_king;
+  int black_king;
+  int pawn;
+  bool white_to_move;
+};
+
+static void init_kpk_bitbase()
+{
+  vector<KPKPosition> db(kpk_max_index);
+  for (int idx = 0; idx < kpk_max_index; idx++)
+    db[idx].init(idx);
+
+  // Keep passing over the unresolved positions until none change
+  bool repeat = true;
+  while (repeat) {
+    repeat = false;
+    for (int idx = 0; idx < kpk_max_index; idx++) {
+      if (db[idx].result == KPK_UNKNOWN && db[idx].classify(db) != KPK_UNKNOWN)
+        repeat = true;
+    }
+  }
+
+  kpk_bitbase.assign(kpk_max_index, false);
+  for (int idx = 0; idx < kpk_max_index; idx++)
+    kpk_bitbase[idx] = db[idx].result == KPK_WIN;
+}
+
+bool kpk_probe(PieceColour strong_side, int strong_king, int pawn,
+  int weak_king, bool strong_side_to_move)
+{
+  if (strong_side == BLACK) {
+    strong_king ^= 56;
+    weak_king ^= 56;
+    pawn ^= 56;
+  }
+  if (file_of(pawn) >= 4) {
+    strong_king ^= 7;
+    weak_king ^= 7;
+    pawn ^= 7;
+  }
+  return kpk_bitbase[kpk_index(strong_side_to_move, weak_king, strong_king, pawn)];
+}
+
+// A view of a small endgame: where each side's pieces stand
+class EndgamePosition {
+public:
+  EndgamePosition(const Square board[8][8], bool whites_turn)
+    : whites_turn(whites_turn)
+  {
+    for (int y = 0; y < 8; y++) {
+      for (int x = 0; x < 8; x++) {
+        if (board[y][x].occupancy == NONE)
+          continue;
+        if (board[y][x].occupancy == KING)
+          king[board[y][x].colour] = y * 8 + x;
+        else
+          pieces[board[y][x].colour][board[y][x].occupancy].push_back(y * 8 + x);
+      }
+    }
+  }
+  int king[2];
+  vector<int> pieces[2][5];
+  bool whites_turn;
+};
+
+typedef int (*EndgameEvaluator)(const EndgamePosition& pos, PieceColour strong);
+
+static int push_to_edge(int sq)
+{
+  const int edge_distance = min(file_of(sq), 7 - file_of(sq)) +
+    min(rank_of(sq), 7 - rank_of(sq));
+  return 20 * (6 - edge_distance);
+}
+
+static int push_close(int a, int b)
+{
+  return 20 * (7 - distance(a, b));
+}
+
+static int evaluate_draw(const EndgamePosition&, PieceColour)
+{
+  return 0;
+}
+
+// King and pawn versus king, exactly from the bitbase
+static int evaluate_kpk(const EndgamePosition& pos, PieceColour strong)
+{
+  const int pawn = pos.pieces[strong][PAWN][0];
+  if (!kpk_probe(strong, pos.king[strong], pawn, pos.king[!strong],
+                 pos.whites_turn == (strong == WHITE)))
+    return 0;
+  const int relative_rank = strong == WHITE ? rank_of(pawn) : 7 - rank_of(pawn);
+  return KNOWN_WIN + 100 + 10 * relative_rank;
+}
+
+// Enough material to force mate against a bare king: drive the king to
+// the edge and bring ours closer
+static int evaluate_kxk(const EndgamePosition& pos, PieceColour strong)
+{
+  static const int piece_values[] = { 100, 300, 300, 500, 900 };
+  int result = 0;
+  for (int piece = PAWN; piece <= QUEEN; piece++)
+    result += piece_values[piece] * static_cast<int>(pos.pieces[strong][piece].size());
+  result += push_to_edge(pos.king[!strong]) +
+    push_close(pos.king[strong], pos.king[!strong]);
+  return KNOWN_WIN + result;
+}
+
+// Bishop and knight can only mate in a corner of the bishop's colour
+static int evaluate_kbnk(const EndgamePosition& pos, PieceColour strong)
+{
+  const int bishop = pos.pieces[strong][BISHOP][0];
+  const bool dark_bishop = (file_of(bishop) + rank_of(bishop)) % 2 == 0;
+  const int corner_distance = dark_bishop
+    ? min(distance(pos.king[!strong], 0), distance(pos.king[!strong], 63))
+    : min(distance(pos.king[!strong], 7), distance(pos.king[!strong], 56));
+  return KNOWN_WIN + 600 + 40 * (7 - corner_distance) +
+    push_close(pos.king[strong], pos.king[!strong]);
+}
+
+class EndgameEntry {
+public:
+  const char* code;
+  EndgameEvaluator evaluator;
+};
+
+// Codes list the stronger side's pieces then the weaker side's, each
+// starting with its king
+static const EndgameEntry endgames[] = {
+  { "KK", evaluate_draw },
+  { "KNK", evaluate_draw },
+  { "KBK", evaluate_draw },
+  { "KNNK", evaluate_draw },
+  { "KPK", evaluate_kpk },
+  { "KBNK", evaluate_kbnk },
+  { "KQK", evaluate_kxk },
+  { "KRK", evaluate_kxk },
+  { "KQQK", evaluate_kxk },
+  { "KQRK", evaluate_kxk },
+  { "KRRK", evaluate_kxk },
+};
+
+// Packs each piece count into four bits, strong side in the high half
+static uint64_t material_key(const int strong[6], const int weak[6])
+{
+  uint64_t key = 0;
+  for (int piece = PAWN; piece <= QUEEN; piece++)
+    key |= static_cast<uint64_t>(strong[piece]) << (4 * piece + 20);
+  for (int piece = PAWN; piece <= QUEEN; piece++)
+    key |= static_cast<uint64_t>(weak[piece]) << (4 * piece);
+  return key;
+}
+
+static uint64_t material_key(const char* code)
+{
+  static const string piece_letters = "PNBRQ";
+  int counts[2][6] = { 0 };
+  int side = -1;
+  for (const char* c = code; *c; c++) {
+    if (*c == 'K')
+      side++;
+    else
+      counts[side][piece_letters.find(*c)]++;
+  }
+  return material_key(counts[0], counts[1]);
+}
+
+static vector<uint64_t> endgame_keys;
+
+void init_endgames()
+{
+  init_kpk_bitbase();
+  for (const EndgameEntry& entry : endgames)
+    endgame_keys.push_back(material_key(entry.code));
+}
+
+bool evaluate_endgame(const Square board[8][8], const int material[2][6],
+  bool whites_turn, int& score)
+{
+  for (int strong = BLACK; strong <= WHITE; strong++) {
+    const uint64_t key = material_key(material[strong], material[!strong]);
+    for (size_t i = 0; i < endgame_keys.size(); i++) {
+      if (endgame_keys[i] != key)
+        continue;
+      EndgamePosition pos(board, whites_turn);
+      const int result = endgames[i].evaluator(pos, static_cast<PieceColour>(strong));
+      score = strong == WHITE ? result : -result;
+      return true;
+    }
+  }
+  return false;
+}
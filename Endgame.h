@@ -0,0 +1,20 @@
+#pragma once
+
+#include "Chess.h"
+
+// Scores beyond this mean the stronger side has a won ending, though not
+// yet a mate the search can see
+constexpr int KNOWN_WIN = 5000;
+
+// Generates the KPK bitbase by retrograde analysis and indexes the
+// specialised evaluators. Must be called once before any evaluation.
+void init_endgames();
+
+// Whether the side with the pawn wins. Squares are y * 8 + x.
+bool kpk_probe(PieceColour strong_side, int strong_king, int pawn,
+  int weak_king, bool strong_side_to_move);
+
+// Looks up a specialised evaluator for the material signature. Returns
+// false if there isn't one, otherwise sets score from white's perspective.
+bool evaluate_endgame(const Square board[8][8], const int material[2][6],
+  bool whites_turn, int& score);
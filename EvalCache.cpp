@@ -0,0 +1,34 @@
+#include "EvalCache.h"
+
+EvalCache::EvalCache(int size_log2)
+  : entries(static_cast<size_t>(1) << size_log2)
+  , mask((static_cast<uint64_t>(1) << size_log2) - 1)
+{
+  clear();
+}
+
+void EvalCache::add(uint64_t hash, int eval)
+{
+  EvalCacheEntry& entry = entries[hash & mask];
+  entry.key = hash;
+  entry.eval = eval;
+}
+
+bool EvalCache::search(uint64_t hash, int& eval)
+{
+  const EvalCacheEntry& entry = entries[hash & mask];
+  if (entry.key != hash)
+    return false;
+  eval = entry.eval;
+  return true;
+}
+
+void EvalCache::clear()
+{
+  for (EvalCacheEntry& entry : entries) {
+    // Key 0 is never a reachable position's hash in practice, so a zeroed
+    // entry never matches
+    entry.key = 0;
+    entry.eval = 0;
+  }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+class EvalCacheEntry {
+public:
+  uint64_t key;
+  int eval;
+};
+
+// Small, lossy cache of static evaluations indexed by Zobrist hash. Unlike
+// the transposition table it holds no search results, only what
+// BoardState::evaluate() returned, so a position reached again by
+// transposition isn't evaluated from scratch. The hash includes the
+// variant, whose rules change the evaluation, so a thread that switches
+// variants never needs to clear it.
+class EvalCache {
+public:
+  EvalCache(int size_log2 = 18);
+  void add(uint64_t hash, int eval);
+  bool search(uint64_t hash, int& eval);
+  void clear();
+private:
+  vector<EvalCacheEntry> entries;
+  uint64_t mask;
+};
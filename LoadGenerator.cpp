@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "LoadGenerator.h"
+#include "Socket.h"
+#include "Utils.h"
+
+// Openings, middlegames and endgames, so requests vary in cost
+static const char* const test_positions[] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+  "r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4",
+  "r2q1rk1/pp2bppp/2n1pn2/3p4/3P4/2NBPN2/PP3PPP/R2QK2R w KQ - 0 9",
+  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+  "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1",
+  "8/8/4k3/8/2K5/3P4/8/8 w - - 0 1",
+  "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+  "r6k/pp3npp/2p5/8/8/2P5/PP1N1KPP/R7 w - - 0 1",
+};
+static const int num_test_positions = sizeof(test_positions) / sizeof(test_positions[0]);
+// Small enough for the repeatability check to be quick
+constexpr int repeat_check_nodes = 20000;
+
+class LoadResults {
+public:
+  mutex results_mutex;
+  vector<double> latencies;        // Completed requests, in milliseconds
+  vector<double> first_progress;   // Request to first info line
+  vector<double> cancel_latencies; // Stop to bestmove
+  int errors = 0;
+};
+
+static double percentile(const vector<double>& sorted, double p)
+{
+  if (sorted.empty())
+    return 0;
+  const size_t index = static_cast<size_t>(p / 100 * (sorted.size() - 1) + 0.5);
+  return sorted[min(index, sorted.size() - 1)];
+}
+
+static void run_client(int client, int port, int num_requests, int depth, LoadResults& results)
+{
+  Socket socket;
+  if (!socket.connect(port)) {
+    lock_guard<mutex> lock(results.results_mutex);
+    results.errors += num_requests;
+    return;
+  }
+
+  for (int r = 0; r < num_requests; r++) {
+    const int request = client * num_requests + r;
+    const string id = to_string(client) + "-" + to_string(r);
+    const bool cancel = request % 10 == 9;
+    ostringstream command;
+    command << "analyse " << id << " depth " << depth << " fen " <<
+      test_positions[request % num_test_positions] << "\n";
+
+    Timer timer;
+    double first_info = -1, stopped_at = -1;
+    bool ok = false;
+    string line;
+    if (!socket.send_all(command.str())) {
+      lock_guard<mutex> lock(results.results_mutex);
+      results.errors += num_requests - r;
+      return;
+    }
+    while (socket.read_line(line)) {
+      istringstream in(line);
+      string kind, reply_id;
+      in >> kind >> reply_id;
+      if (reply_id != id)
+        continue;
+      if (kind == "info" && first_info < 0) {
+        first_info = timer.elapsed() * 1000;
+        if (cancel) {
+          socket.send_all("stop " + id + "\n");
+          stopped_at = timer.elapsed() * 1000;
+        }
+      } else if (kind == "bestmove") {
+        ok = true;
+        break;
+      } else if (kind == "error") {
+        break;
+      }
+    }
+    const double elapsed = timer.elapsed() * 1000;
+
+    lock_guard<mutex> lock(results.results_mutex);
+    if (!ok) {
+      results.errors++;
+      continue;
+    }
+    if (first_info >= 0)
+      results.first_progress.push_back(first_info);
+    if (stopped_at >= 0)
+      results.cancel_latencies.push_back(elapsed - stopped_at);
+    else
+      results.latencies.push_back(elapsed);
+  }
+}
+
+// Sends a request and waits for its answer, which is returned without the
+// request's id
+static bool request_answer(Socket& socket, const string& id, const string& request, string& answer)
+{
+  if (!socket.send_all(request + "\n"))
+    return false;
+  string line;
+  while (socket.read_line(line)) {
+    istringstream in(line);
+    string kind, reply_id;
+    in >> kind >> reply_id;
+    if (reply_id != id || kind == "info")
+      continue;
+    getline(in, answer);
+    return kind != "error";
+  }
+  return false;
+}
+
+// A node-limited request should get the same answer every time, whatever
+// the worker searched before it. Every position is analysed once, and then
+// again straight after being analysed in each other variant, when anything
+// the worker kept from the other variant would be fresh. Every answer is
+// compared with the first. The worker is only sure to be the same one
+// when the server has one. Returns the number of positions that failed or
+// differed.
+static int check_repeatable(int port)
+{
+  static const char* const variants[] = { "atomic", "hill" };
+  Socket socket;
+  if (!socket.connect(port))
+    return num_test_positions;
+  vector<string> requests, first(num_test_positions);
+  vector<bool> ok(num_test_positions);
+  for (int p = 0; p < num_test_positions; p++) {
+    const string id = "repeat-" + to_string(p);
+    requests.push_back("analyse " + id + " nodes " + to_string(repeat_check_nodes) +
+      " fen " + test_positions[p]);
+    ok[p] = request_answer(socket, id, requests[p], first[p]);
+  }
+  int failures = 0;
+  for (int p = 0; p < num_test_positions; p++) {
+    const string id = "repeat-" + to_string(p);
+    string other, again;
+    for (const char* variant : variants) {
+      if (!ok[p])
+        break;
+      const string in_variant = "analyse " + id + " variant " + variant +
+        requests[p].substr(("analyse " + id).size());
+      ok[p] = request_answer(socket, id, in_variant, other) &&
+        request_answer(socket, id, requests[p], again);
+      if (ok[p] && again != first[p]) {
+        cout << "Not repeatable after " << variant << ": " << test_positions[p] <<
+          "\n  first:" << first[p] << "\n  again:" << again << "\n";
+        ok[p] = false;
+      }
+    }
+    failures += !ok[p];
+  }
+  cout << "Repeated " << num_test_positions << " node-limited requests after other variants, " <<
+    failures << " failed or differed\n";
+  return failures;
+}
+
+static void report(const char* name, vector<double>& values)
+{
+  sort(values.begin(), values.end());
+  cout << name << " (ms, " << values.size() << " samples): p50 " << percentile(values, 50) <<
+    ", p90 " << percentile(values, 90) << ", p99 " << percentile(values, 99) <<
+    ", max " << (values.empty() ? 0 : values.back()) << "\n";
+}
+
+int run_load_test(int port, int num_connections, int requests_per_connection, int depth)
+{
+  cout << "Sending " << num_connections * requests_per_connection << " requests of depth " <<
+    depth << " over " << num_connections << " connections to port " << port << "\n";
+  LoadResults results;
+  results.errors = check_repeatable(port);
+  Timer timer;
+  vector<thread> clients;
+  for (int c = 0; c < num_connections; c++)
+    clients.emplace_back(run_client, c, port, requests_per_connection, depth, ref(results));
+  for (thread& client : clients)
+    client.join();
+  const double seconds = timer.elapsed();
+
+  const size_t answered = results.latencies.size() + results.cancel_latencies.size();
+  cout << "Answered " << answered << " requests in " << seconds << " seconds, " <<
+    answered / seconds << " per second\n";
+  if (results.errors)
+    cout << "Failed or not repeatable: " << results.errors << "\n";
+  report("Latency", results.latencies);
+  report("First progress", results.first_progress);
+  report("Stop to reply", results.cancel_latencies);
+  return results.errors ? 1 : 0;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// Drives an analysis server on 127.0.0.1 from a number of connections,
+// each sending its next request as soon as the last one is answered, and
+// reports throughput and latency percentiles. Every tenth request is
+// stopped once it reports progress, to exercise cancellation.
+//
+// First it checks that node-limited requests are repeatable: each test
+// position gets the same answer before and after it is analysed in the
+// other variants. Run the server with Threads=1 for the check to be sure
+// of reusing one worker.
+int run_load_test(int port, int num_connections, int requests_per_connection, int depth);
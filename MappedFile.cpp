@@ -0,0 +1,85 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+  : base(nullptr)
+  , length(0)
+#ifdef _WIN32
+  , mapping(nullptr)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+bool MappedFile::open(const string& path)
+{
+  close();
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+    nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (!mapping)
+    return false;
+  base = static_cast<const uint8_t*>(
+    MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if (!base) {
+    CloseHandle(mapping);
+    mapping = nullptr;
+    return false;
+  }
+  length = static_cast<size_t>(file_size.QuadPart);
+#else
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED)
+    return false;
+  base = static_cast<const uint8_t*>(addr);
+  length = static_cast<size_t>(st.st_size);
+#endif
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (!base)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(base);
+  CloseHandle(mapping);
+  mapping = nullptr;
+#else
+  munmap(const_cast<uint8_t*>(base), length);
+#endif
+  base = nullptr;
+  length = 0;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+using namespace std;
+
+// A read-only memory mapping of a whole file
+class MappedFile {
+public:
+  MappedFile();
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  bool open(const string& path);
+  void close();
+  const uint8_t* data() const { return base; }
+  size_t size() const { return length; }
+private:
+  const uint8_t* base;
+  size_t length;
+#ifdef _WIN32
+  void* mapping;
+#endif
+};
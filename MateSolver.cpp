@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <list>
+
+#include "MateSolver.h"
+#include "Utils.h"
+
+// Proof and disproof numbers are kept from the point of view of the side to
+// move: phi is the work left to prove it achieves its goal and delta the
+// work left to show it can't. The attacker's goal is a win, the defender's
+// is anything else. Then phi(n) = min delta(child) and delta(n) =
+// sum phi(child), whoever is to move.
+constexpr uint32_t pn_infinity = 100000000;
+constexpr int max_line_length = 200;
+
+class MateEntry {
+public:
+  uint64_t key;
+  uint32_t phi;
+  uint32_t delta;
+  uint32_t work; // Nodes expanded under the position when it was stored
+};
+
+// Two entries per bucket: the first keeps whichever position took the
+// most work to settle, the second is always replaced
+class MateTable {
+public:
+  MateTable(size_t megabytes);
+  const MateEntry* find(uint64_t key) const;
+  void store(uint64_t key, uint32_t phi, uint32_t delta, uint64_t work);
+private:
+  vector<MateEntry> entries;
+  size_t bucket_mask;
+};
+
+MateTable::MateTable(size_t megabytes)
+{
+  size_t num_buckets = 1;
+  while (num_buckets * 4 * sizeof(MateEntry) <= megabytes * 1024 * 1024)
+    num_buckets *= 2;
+  entries.assign(num_buckets * 2, MateEntry{ 0, 0, 0, 0 });
+  bucket_mask = num_buckets - 1;
+}
+
+const MateEntry* MateTable::find(uint64_t key) const
+{
+  const MateEntry* bucket = &entries[(key & bucket_mask) * 2];
+  for (int i = 0; i < 2; i++) {
+    if (bucket[i].key == key && bucket[i].work)
+      return &bucket[i];
+  }
+  return nullptr;
+}
+
+void MateTable::store(uint64_t key, uint32_t phi, uint32_t delta, uint64_t work)
+{
+  MateEntry* bucket = &entries[(key & bucket_mask) * 2];
+  const MateEntry entry{ key, phi, delta, static_cast<uint32_t>(min<uint64_t>(work, UINT32_MAX)) };
+  if (bucket[0].key == key || entry.work >= bucket[0].work) {
+    if (bucket[0].key != key)
+      bucket[1] = bucket[0];
+    bucket[0] = entry;
+  } else {
+    bucket[1] = entry;
+  }
+}
+
+class MateSolver {
+public:
+  MateSolver(const MateLimits& limits);
+  void solve(const BoardState& state, bool attacking,
+    uint32_t phi_threshold, uint32_t delta_threshold);
+  void lookup(const BoardState& state, bool attacking, uint32_t& phi, uint32_t& delta,
+    uint32_t& work) const;
+  bool out_of_budget() const;
+
+  const MateLimits& limits;
+  MateTable table;
+  uint64_t nodes;
+  // Hashes of the positions on the line being searched
+  vector<uint64_t> path;
+};
+
+MateSolver::MateSolver(const MateLimits& limits)
+  : limits(limits)
+  , table(limits.megabytes)
+  , nodes(0)
+{
+}
+
+bool MateSolver::out_of_budget() const
+{
+  return nodes >= limits.max_nodes ||
+    (limits.stop && limits.stop->load(memory_order_relaxed));
+}
+
+// Current numbers for a position: settled if the game is over there or
+// it repeats the line, else from the table, else a first guess that a
+// side with more moves is harder to beat
+void MateSolver::lookup(const BoardState& state, bool attacking, uint32_t& phi,
+  uint32_t& delta, uint32_t& work) const
+{
+  work = 0;
+  const bool repeated = find(path.begin(), path.end(), state.zobrist_hash) != path.end();
+  if (!repeated && state.possible_moves.empty() && state.side_to_move_lost()) {
+    phi = pn_infinity;
+    delta = 0;
+  } else if (repeated || state.possible_moves.empty()) {
+    // Drawing is the defender's goal and a failure for the attacker
+    phi = attacking ? pn_infinity : 0;
+    delta = attacking ? 0 : pn_infinity;
+  } else if (const MateEntry* entry = table.find(state.zobrist_hash)) {
+    phi = entry->phi;
+    delta = entry->delta;
+    work = entry->work;
+  } else {
+    phi = 1;
+    delta = static_cast<uint32_t>(state.possible_moves.size());
+  }
+}
+
+// Expands the position until its phi or delta reaches the threshold, then
+// stores what it learned
+void MateSolver::solve(const BoardState& state, bool attacking,
+  uint32_t phi_threshold, uint32_t delta_threshold)
+{
+  const uint64_t start_nodes = nodes++;
+  path.push_back(state.zobrist_hash);
+
+  vector<BoardState> children;
+  children.reserve(state.possible_moves.size());
+  for (const Move& move : state.possible_moves)
+    children.emplace_back(&state, &move);
+
+  uint32_t phi, delta, work;
+  while (true) {
+    // The child with the smallest delta is the most promising; the second
+    // smallest bounds how long to stay with it
+    size_t best = 0;
+    uint32_t best_delta = pn_infinity, second_delta = pn_infinity, best_phi = 0;
+    uint64_t phi_sum = 0;
+    for (size_t i = 0; i < children.size(); i++) {
+      uint32_t child_phi, child_delta;
+      lookup(children[i], !attacking, child_phi, child_delta, work);
+      // Only a child whose mover is sure to reach its goal makes the sum
+      // infinite. Large sums of unsettled children stop just short.
+      phi_sum = child_phi == pn_infinity || phi_sum == pn_infinity ? pn_infinity :
+        min<uint64_t>(phi_sum + child_phi, pn_infinity - 1);
+      if (child_delta < best_delta) {
+        second_delta = best_delta;
+        best_delta = child_delta;
+        best_phi = child_phi;
+        best = i;
+      } else if (child_delta < second_delta) {
+        second_delta = child_delta;
+      }
+    }
+    phi = best_delta;
+    delta = static_cast<uint32_t>(phi_sum);
+    if (phi >= phi_threshold || delta >= delta_threshold || out_of_budget())
+      break;
+
+    solve(children[best], !attacking,
+      delta_threshold - delta + best_phi,
+      min(phi_threshold, second_delta + 1));
+  }
+
+  path.pop_back();
+  table.store(state.zobrist_hash, phi, delta, nodes - start_nodes);
+}
+
+// Walks the proof from the root. The attacker takes the win that was
+// quickest to prove, the defender the reply that was slowest to refute.
+static void winning_line(const MateSolver& solver, const BoardState& root, vector<string>& line)
+{
+  list<BoardState> positions;
+  const BoardState* state = &root;
+  bool attacking = true;
+  while (!state->possible_moves.empty() && line.size() < max_line_length) {
+    const Move* chosen = nullptr;
+    uint32_t chosen_work = 0;
+    for (const Move& move : state->possible_moves) {
+      BoardState child(state, &move, true);
+      uint32_t phi, delta, work;
+      solver.lookup(child, !attacking, phi, delta, work);
+      // A won child is one where the attacker has reached its goal: the
+      // defender to move can't escape, or the attacker to move has a win
+      const bool won = attacking ? delta == 0 : phi == 0;
+      if (won && (!chosen || (attacking ? work < chosen_work : work > chosen_work))) {
+        chosen = &move;
+        chosen_work = work;
+      }
+    }
+    if (!chosen)
+      break;
+    string str;
+    move_to_string(state, chosen, str);
+    line.push_back(str);
+    positions.emplace_back(state, chosen, true);
+    state = &positions.back();
+    attacking = !attacking;
+  }
+}
+
+MateResult solve_mate(const BoardState& root, const MateLimits& limits)
+{
+  MateResult result;
+  MateSolver solver(limits);
+  solver.solve(root, true, pn_infinity, pn_infinity);
+  result.nodes = solver.nodes;
+
+  uint32_t phi, delta, work;
+  solver.lookup(root, true, phi, delta, work);
+  if (phi == 0) {
+    result.status = MATE_PROVEN;
+    winning_line(solver, root, result.line);
+  } else if (delta == 0) {
+    result.status = MATE_DISPROVEN;
+  }
+  return result;
+}
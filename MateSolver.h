@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Chess.h"
+
+using namespace std;
+
+// Proves forced wins with depth-first proof-number search (df-pn). Rather
+// than deepening every line together, it keeps expanding whichever line is
+// currently cheapest to prove or refute, so narrow, deep wins are found
+// long before alpha-beta would reach them. A win is anything that ends the
+// game in the mover's favour in the current variant: mate, an exploded
+// king or a king on the hill.
+//
+// Repetitions count as draws along the line being searched. That can cost
+// the solver a proof, but never gives it a false one.
+
+enum MateStatus {
+  MATE_UNKNOWN,   // The node budget ran out or the search was stopped
+  MATE_PROVEN,    // The side to move has a forced win
+  MATE_DISPROVEN, // It has none
+};
+
+class MateLimits {
+public:
+  size_t megabytes = 16;          // Size of the solver's own table
+  uint64_t max_nodes = 2000000;   // Positions expanded before giving up
+  const atomic<bool>* stop = nullptr;
+};
+
+class MateResult {
+public:
+  MateStatus status = MATE_UNKNOWN;
+  // When proven, the winning line with the longest defence the table
+  // still remembers
+  vector<string> line;
+  uint64_t nodes = 0;
+};
+
+// Solves for the side to move, in the variant set on the calling thread
+MateResult solve_mate(const BoardState& root, const MateLimits& limits);
@@ -0,0 +1,235 @@
+#include <fstream>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "Nnue.h"
+
+constexpr uint32_t nnue_version = 0x7AF32F16;
+constexpr uint32_t nnue_architecture_hash = 0x3E5AA6EE; // HalfKP 256x2-32-32
+
+// One feature per (own king square, non-king piece, square). Index 0 of each
+// king's block is unused, a leftover from the format's shogi origins.
+constexpr int piece_square_end = 1 + 10 * 64;
+constexpr int nnue_input_dimensions = 64 * piece_square_end;
+
+constexpr int hidden_dimensions = 32;
+constexpr int transformed_dimensions = 2 * nnue_half_dimensions;
+constexpr int weight_scale_bits = 6;
+constexpr int output_scale = 16;
+// Network output is in units where an endgame pawn is worth 208
+constexpr int network_pawn_value = 208;
+
+class AffineLayer {
+public:
+  vector<int32_t> biases;
+  vector<int8_t> weights;
+};
+
+static bool loaded = false;
+static vector<int16_t> feature_biases;
+static vector<int16_t> feature_weights;
+static AffineLayer hidden1, hidden2, output_layer;
+
+template <typename T>
+static bool read_values(ifstream& in, vector<T>& values, size_t count)
+{
+  values.resize(count);
+  in.read(reinterpret_cast<char*>(values.data()), count * sizeof(T));
+  return static_cast<bool>(in);
+}
+
+static bool read_u32(ifstream& in, uint32_t& value)
+{
+  in.read(reinterpret_cast<char*>(&value), sizeof(value));
+  return static_cast<bool>(in);
+}
+
+static bool read_affine(ifstream& in, AffineLayer& layer, int inputs, int outputs)
+{
+  return read_values(in, layer.biases, outputs) &&
+    read_values(in, layer.weights, static_cast<size_t>(inputs) * outputs);
+}
+
+bool nnue_init(const string& path)
+{
+  loaded = false;
+  ifstream in(path, ios::binary);
+  uint32_t version, hash, description_size, section_hash;
+  if (!read_u32(in, version) || !read_u32(in, hash) || !read_u32(in, description_size))
+    return false;
+  if (version != nnue_version || hash != nnue_architecture_hash)
+    return false;
+  in.ignore(description_size);
+
+  if (!read_u32(in, section_hash) ||
+      !read_values(in, feature_biases, nnue_half_dimensions) ||
+      !read_values(in, feature_weights,
+        static_cast<size_t>(nnue_input_dimensions) * nnue_half_dimensions))
+    return false;
+
+  if (!read_u32(in, section_hash) ||
+      !read_affine(in, hidden1, transformed_dimensions, hidden_dimensions) ||
+      !read_affine(in, hidden2, hidden_dimensions, hidden_dimensions) ||
+      !read_affine(in, output_layer, hidden_dimensions, 1))
+    return false;
+
+  // Anything left over means the file has a different architecture
+  in.peek();
+  loaded = in.eof();
+  return loaded;
+}
+
+bool nnue_loaded()
+{
+  return loaded;
+}
+
+// The network sees the board from each side's point of view, so black's
+// half is rotated to put its pieces at the bottom
+static int orient(int perspective, int square)
+{
+  return perspective ? square : square ^ 63;
+}
+
+static int feature_index(int perspective, int king_square, int piece, int colour, int square)
+{
+  const int piece_offset = 1 + piece * 128 + (colour == perspective ? 0 : 64);
+  return orient(perspective, square) + piece_offset +
+    piece_square_end * orient(perspective, king_square);
+}
+
+static void add_weights(int16_t* values, const int16_t* weights)
+{
+#ifdef __AVX2__
+  for (int i = 0; i < nnue_half_dimensions; i += 16) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+    __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + i), _mm256_add_epi16(v, w));
+  }
+#else
+  for (int i = 0; i < nnue_half_dimensions; i++)
+    values[i] += weights[i];
+#endif
+}
+
+static void subtract_weights(int16_t* values, const int16_t* weights)
+{
+#ifdef __AVX2__
+  for (int i = 0; i < nnue_half_dimensions; i += 16) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+    __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + i), _mm256_sub_epi16(v, w));
+  }
+#else
+  for (int i = 0; i < nnue_half_dimensions; i++)
+    values[i] -= weights[i];
+#endif
+}
+
+void nnue_reset(Accumulator& acc, int perspective, int king_square)
+{
+  for (int i = 0; i < nnue_half_dimensions; i++)
+    acc.values[perspective][i] = feature_biases[i];
+  acc.king_square[perspective] = king_square;
+  acc.dirty[perspective] = false;
+}
+
+void nnue_add_feature(Accumulator& acc, int perspective, int piece, int colour, int square)
+{
+  const int index = feature_index(perspective, acc.king_square[perspective], piece, colour, square);
+  add_weights(acc.values[perspective],
+    &feature_weights[static_cast<size_t>(index) * nnue_half_dimensions]);
+}
+
+void nnue_add_piece(Accumulator& acc, int piece, int colour, int square)
+{
+  for (int p = 0; p < 2; p++) {
+    if (!acc.dirty[p])
+      nnue_add_feature(acc, p, piece, colour, square);
+  }
+}
+
+void nnue_remove_piece(Accumulator& acc, int piece, int colour, int square)
+{
+  for (int p = 0; p < 2; p++) {
+    if (acc.dirty[p])
+      continue;
+    const int index = feature_index(p, acc.king_square[p], piece, colour, square);
+    subtract_weights(acc.values[p], &feature_weights[static_cast<size_t>(index) * nnue_half_dimensions]);
+  }
+}
+
+// Clamps both halves to 0..127, side to move first
+static void transform(const Accumulator& acc, bool whites_turn, uint8_t* output)
+{
+  const int perspectives[2] = { whites_turn ? 1 : 0, whites_turn ? 0 : 1 };
+  for (int p = 0; p < 2; p++) {
+    const int16_t* values = acc.values[perspectives[p]];
+    uint8_t* out = output + p * nnue_half_dimensions;
+#ifdef __AVX2__
+    const __m256i zero = _mm256_setzero_si256();
+    for (int i = 0; i < nnue_half_dimensions; i += 32) {
+      __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+      __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i + 16));
+      // packs works within 128-bit lanes, so put the quarters back in order
+      __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_max_epi8(packed, zero));
+    }
+#else
+    for (int i = 0; i < nnue_half_dimensions; i++)
+      out[i] = static_cast<uint8_t>(values[i] < 0 ? 0 : values[i] > 127 ? 127 : values[i]);
+#endif
+  }
+}
+
+static int32_t dot_product(const uint8_t* input, const int8_t* weights, int count)
+{
+#ifdef __AVX2__
+  if (count % 32 == 0) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < count; i += 32) {
+      __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+      __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i));
+      __m256i products = _mm256_maddubs_epi16(in, w);
+      sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+    }
+    __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0x4E));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0xB1));
+    return _mm_cvtsi128_si32(sum128);
+  }
+#endif
+  int32_t sum = 0;
+  for (int i = 0; i < count; i++)
+    sum += input[i] * weights[i];
+  return sum;
+}
+
+// Affine layer followed by the clipped ReLU that scales back to 0..127
+static void hidden_layer(const AffineLayer& layer, const uint8_t* input, int inputs, uint8_t* output)
+{
+  for (int i = 0; i < hidden_dimensions; i++) {
+    const int32_t sum = layer.biases[i] + dot_product(input, &layer.weights[i * inputs], inputs);
+    const int32_t scaled = sum >> weight_scale_bits;
+    output[i] = static_cast<uint8_t>(scaled < 0 ? 0 : scaled > 127 ? 127 : scaled);
+  }
+}
+
+int nnue_evaluate(const Accumulator& acc, bool whites_turn)
+{
+  uint8_t transformed[transformed_dimensions];
+  uint8_t hidden1_out[hidden_dimensions];
+  uint8_t hidden2_out[hidden_dimensions];
+
+  transform(acc, whites_turn, transformed);
+  hidden_layer(hidden1, transformed, transformed_dimensions, hidden1_out);
+  hidden_layer(hidden2, hidden1_out, hidden_dimensions, hidden2_out);
+  const int32_t output = output_layer.biases[0] +
+    dot_product(hidden2_out, output_layer.weights.data(), hidden_dimensions);
+
+  return output / output_scale * 100 / network_pawn_value;
+}
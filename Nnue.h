@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Evaluation by an efficiently updatable neural network in the HalfKP
+// 256x2-32-32 layout used by Stockfish 12 .nnue files. Each side's half of
+// the first layer is kept in an Accumulator, which add_piece/remove_piece
+// update as pieces move and which is only rebuilt when that side's king moves.
+
+constexpr int nnue_half_dimensions = 256;
+
+class Accumulator {
+public:
+  int16_t values[2][nnue_half_dimensions];
+  int king_square[2];
+  bool dirty[2];
+};
+
+// Loads a network, replacing any loaded before. On failure the classical
+// evaluation stays in use.
+bool nnue_init(const string& path);
+bool nnue_loaded();
+
+// Starts one perspective's half from the biases alone, with that side's king
+// on king_square (y * 8 + x)
+void nnue_reset(Accumulator& acc, int perspective, int king_square);
+
+// Adds a non-king piece to one perspective's half, for rebuilding it
+void nnue_add_feature(Accumulator& acc, int perspective, int piece, int colour, int square);
+
+// Adds or removes a non-king piece in every perspective that isn't dirty.
+// Piece and colour take the values of the Piece and PieceColour enums.
+void nnue_add_piece(Accumulator& acc, int piece, int colour, int square);
+void nnue_remove_piece(Accumulator& acc, int piece, int colour, int square);
+
+// Score in centipawns for the side to move
+int nnue_evaluate(const Accumulator& acc, bool whites_turn);
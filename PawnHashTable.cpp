@@ -0,0 +1,34 @@
+#include "PawnHashTable.h"
+
+PawnHashTable::PawnHashTable(int size_log2)
+  : entries(static_cast<size_t>(1) << size_log2)
+  , mask((static_cast<uint64_t>(1) << size_log2) - 1)
+{
+  clear();
+}
+
+void PawnHashTable::add(uint64_t pawn_hash, int score)
+{
+  PawnEntry& entry = entries[pawn_hash & mask];
+  entry.key = pawn_hash;
+  entry.score = score;
+}
+
+bool PawnHashTable::search(uint64_t pawn_hash, int& score)
+{
+  const PawnEntry& entry = entries[pawn_hash & mask];
+  if (entry.key != pawn_hash)
+    return false;
+  score = entry.score;
+  return true;
+}
+
+void PawnHashTable::clear()
+{
+  for (PawnEntry& entry : entries) {
+    // A zeroed entry only matches the pawnless structure, whose score of 0
+    // is correct anyway
+    entry.key = 0;
+    entry.score = 0;
+  }
+}
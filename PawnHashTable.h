@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+class PawnEntry {
+public:
+  uint64_t key;
+  int score;
+};
+
+// Fixed-size, always-replace cache of pawn structure scores, indexed by the
+// pawn-only Zobrist key. Pawn structure changes rarely between nodes, so
+// nearly every probe hits.
+class PawnHashTable {
+public:
+  PawnHashTable(int size_log2 = 16);
+  void add(uint64_t pawn_hash, int score);
+  bool search(uint64_t pawn_hash, int& score);
+  void clear();
+private:
+  vector<PawnEntry> entries;
+  uint64_t mask;
+};
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <thread>
+
+#include "MappedFile.h"
+#include "Pgn.h"
+#include "Utils.h"
+
+// Files are cut into pieces of about this size for the workers to share
+constexpr size_t pgn_chunk_size = 4 << 20;
+
+void PgnTags::clear()
+{
+  result = RESULT_UNKNOWN;
+  variant = VARIANT_NONE;
+  supported_variant = true;
+  fen.clear();
+}
+
+static bool is_space(char c)
+{
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// Where a token of movetext ends
+static bool is_delimiter(char c)
+{
+  return is_space(c) || c == '{' || c == '}' || c == '(' || c == ')' || c == ';';
+}
+
+static bool token_is(const char* begin, const char* end, const char* text)
+{
+  const size_t length = strlen(text);
+  return static_cast<size_t>(end - begin) == length && memcmp(begin, text, length) == 0;
+}
+
+static const char* skip_line(const char* pos, const char* end)
+{
+  const char* newline = static_cast<const char*>(memchr(pos, '\n', end - pos));
+  return newline ? newline + 1 : end;
+}
+
+static GameResult parse_result(const char* begin, const char* end)
+{
+  if (token_is(begin, end, "1-0"))
+    return RESULT_WHITE_WIN;
+  if (token_is(begin, end, "0-1"))
+    return RESULT_BLACK_WIN;
+  if (token_is(begin, end, "1/2-1/2"))
+    return RESULT_DRAW;
+  return RESULT_UNKNOWN;
+}
+
+static void apply_tag(const string& name, const string& value, PgnTags& tags)
+{
+  if (name == "Result") {
+    tags.result = parse_result(value.data(), value.data() + value.size());
+  } else if (name == "FEN") {
+    tags.fen = value;
+  } else if (name == "Variant") {
+    string lower;
+    for (char c : value) {
+      if (!is_space(c) && c != '-')
+        lower.push_back(static_cast<char>(tolower(static_cast<unsigned char>(c))));
+    }
+    if (lower == "standard" || lower == "fromposition")
+      tags.variant = VARIANT_NONE;
+    else if (lower == "atomic")
+      tags.variant = VARIANT_ATOMIC;
+    else if (lower == "kingofthehill")
+      tags.variant = VARIANT_HILL;
+    else
+      tags.supported_variant = false;
+  }
+}
+
+PgnReader::PgnReader(const char* begin, const char* end)
+  : pos(begin)
+  , end(end)
+  , in_movetext(false)
+{
+}
+
+bool PgnReader::next_game(PgnTags& tags)
+{
+  const char* move_begin;
+  const char* move_end;
+  while (next_move(move_begin, move_end)) {}
+
+  tags.clear();
+  bool found_tags = false;
+  string name, value;
+  while (pos < end) {
+    if (is_space(*pos)) {
+      pos++;
+    } else if (*pos == '%' || *pos == ';') {
+      pos = skip_line(pos, end);
+    } else if (*pos == '[') {
+      // [Name "Value"], where the value may contain escaped quotes
+      found_tags = true;
+      name.clear();
+      value.clear();
+      for (pos++; pos < end && !is_space(*pos) && *pos != '"' && *pos != ']'; pos++)
+        name.push_back(*pos);
+      while (pos < end && *pos != '"' && *pos != ']' && *pos != '\n')
+        pos++;
+      if (pos < end && *pos == '"') {
+        for (pos++; pos < end && *pos != '"' && *pos != '\n'; pos++) {
+          if (*pos == '\\' && pos + 1 < end)
+            pos++;
+          value.push_back(*pos);
+        }
+      }
+      pos = skip_line(pos, end);
+      apply_tag(name, value, tags);
+    } else {
+      in_movetext = true;
+      return true;
+    }
+  }
+  // A game may have tags and nothing else
+  return found_tags;
+}
+
+bool PgnReader::next_move(const char*& move_begin, const char*& move_end)
+{
+  int variation_depth = 0;
+  while (in_movetext && pos < end) {
+    const char c = *pos;
+    if (is_space(c)) {
+      pos++;
+      continue;
+    }
+    if (c == '{') {
+      const char* close = static_cast<const char*>(memchr(pos, '}', end - pos));
+      pos = close ? close + 1 : end;
+      continue;
+    }
+    if (c == ';' || c == '%') {
+      pos = skip_line(pos, end);
+      continue;
+    }
+    if (c == '(' || c == ')') {
+      variation_depth = max(0, variation_depth + (c == '(' ? 1 : -1));
+      pos++;
+      continue;
+    }
+    // Tags mean the next game has started without a result
+    if (c == '[' && variation_depth == 0)
+      break;
+
+    const char* token = pos;
+    while (pos < end && !is_delimiter(*pos))
+      pos++;
+    // Variations, NAGs and annotations written apart from their move
+    if (variation_depth > 0 || c == '$' || c == '!' || c == '?')
+      continue;
+    if (c == '*' || parse_result(token, pos) != RESULT_UNKNOWN)
+      break;
+    if ((c >= '1' && c <= '9') || c == '.') {
+      // A move number, which may run straight into the move
+      for (pos = token; pos < end && ((*pos >= '0' && *pos <= '9') || *pos == '.'); pos++) {}
+      continue;
+    }
+    move_begin = token;
+    move_end = pos;
+    return true;
+  }
+  in_movetext = false;
+  return false;
+}
+
+class PgnChunk {
+public:
+  const char* begin;
+  const char* end;
+};
+
+// Cuts a file into chunks that each start at the beginning of a game
+static void split_into_chunks(const MappedFile& file, vector<PgnChunk>& chunks)
+{
+  static const char game_start[] = "\n[Event ";
+  const char* begin = reinterpret_cast<const char*>(file.data());
+  const char* end = begin + file.size();
+  while (begin < end) {
+    const char* split = end;
+    if (static_cast<size_t>(end - begin) > pgn_chunk_size) {
+      split = search(begin + pgn_chunk_size, end, game_start, game_start + strlen(game_start));
+      if (split != end)
+        split++;
+    }
+    chunks.push_back({ begin, split });
+    begin = split;
+  }
+}
+
+static void replay_chunk(const PgnChunk& chunk, const PositionVisitor& visit, PgnStats& stats)
+{
+  PgnReader reader(chunk.begin, chunk.end);
+  PgnTags tags;
+  // The engine makes moves by copying, so each move is made into whichever
+  // of these doesn't hold the current position
+  BoardState positions[2];
+  const char* move_begin;
+  const char* move_end;
+  while (reader.next_game(tags)) {
+    stats.games++;
+    if (!tags.supported_variant) {
+      stats.skipped_games++;
+      continue;
+    }
+    set_variant(tags.variant);
+    int current = 0;
+    positions[current] = BoardState();
+    if (!tags.fen.empty() && !positions[current].load_fen(tags.fen)) {
+      stats.failed_games++;
+      continue;
+    }
+    stats.positions++;
+    if (visit)
+      visit(positions[current], tags.result);
+
+    while (reader.next_move(move_begin, move_end)) {
+      const Move* move;
+      if (!parse_san(positions[current], move_begin, move_end, move)) {
+        stats.failed_games++;
+        break;
+      }
+      positions[!current] = BoardState(&positions[current], move);
+      current = !current;
+      // Otherwise the repetition check would follow the two positions round
+      // in a loop. A repetition only ends a game once claimed, so games
+      // that carry on past one are replayed as played.
+      positions[current].previous_state = nullptr;
+      stats.positions++;
+      if (visit)
+        visit(positions[current], tags.result);
+    }
+  }
+}
+
+PgnStats replay_pgn_files(const vector<string>& paths, int num_threads, const PositionVisitor& visit)
+{
+  Timer timer;
+  PgnStats total;
+  list<MappedFile> files;
+  vector<PgnChunk> chunks;
+  for (const string& path : paths) {
+    files.emplace_back();
+    if (!files.back().open(path)) {
+      cout << "Failed to open " << path << "\n";
+      files.pop_back();
+      continue;
+    }
+    total.bytes += files.back().size();
+    split_into_chunks(files.back(), chunks);
+  }
+
+  num_threads = max(1, min(num_threads, static_cast<int>(chunks.size())));
+  vector<PgnStats> thread_stats(num_threads);
+  atomic<size_t> next_chunk(0);
+  vector<thread> workers;
+  for (int i = 0; i < num_threads; i++) {
+    workers.emplace_back([&, i] {
+      for (size_t c = next_chunk++; c < chunks.size(); c = next_chunk++)
+        replay_chunk(chunks[c], visit, thread_stats[i]);
+    });
+  }
+  for (thread& worker : workers)
+    worker.join();
+
+  for (const PgnStats& stats : thread_stats) {
+    total.games += stats.games;
+    total.positions += stats.positions;
+    total.failed_games += stats.failed_games;
+    total.skipped_games += stats.skipped_games;
+  }
+  total.seconds = timer.elapsed();
+  return total;
+}
+
+void run_pgn_replay(const vector<string>& paths, int num_threads)
+{
+  const PgnStats stats = replay_pgn_files(paths, num_threads);
+  const double seconds = max(stats.seconds, 1e-9);
+  cout << "Replayed " << stats.games << " games (" << stats.positions << " positions, " <<
+    stats.bytes / (1024 * 1024) << " MB) in " << stats.seconds << " seconds: " <<
+    static_cast<uint64_t>(stats.games / seconds) << " games/s, " <<
+    static_cast<uint64_t>(stats.positions / seconds) << " positions/s\n";
+  if (stats.failed_games)
+    cout << "Stopped early on an unplayable move: " << stats.failed_games << " games\n";
+  if (stats.skipped_games)
+    cout << "Skipped in unsupported variants: " << stats.skipped_games << " games\n";
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Chess.h"
+
+using namespace std;
+
+enum GameResult {
+  RESULT_UNKNOWN,
+  RESULT_WHITE_WIN,
+  RESULT_BLACK_WIN,
+  RESULT_DRAW,
+};
+
+// The tags that decide how a game is replayed
+class PgnTags {
+public:
+  void clear();
+  GameResult result = RESULT_UNKNOWN;
+  Variant variant = VARIANT_NONE;
+  bool supported_variant = true;
+  string fen;
+};
+
+// Reads games one at a time from PGN text held in memory, without copying
+// it. Tags are read up front; the movetext is then handed out a move at a
+// time, with move numbers, comments, variations and NAGs skipped over.
+class PgnReader {
+public:
+  PgnReader(const char* begin, const char* end);
+  // Moves on to the next game and reads its tags, skipping whatever is left
+  // of the current one. Returns false at the end of the text.
+  bool next_game(PgnTags& tags);
+  // The next move of the current game, or false once it ends
+  bool next_move(const char*& begin, const char*& end);
+private:
+  const char* pos;
+  const char* end;
+  bool in_movetext;
+};
+
+class PgnStats {
+public:
+  uint64_t games = 0;
+  uint64_t positions = 0;     // Positions reached, each game's first included
+  uint64_t failed_games = 0;  // Cut short by a move that couldn't be played
+  uint64_t skipped_games = 0; // In a variant the engine doesn't play
+  uint64_t bytes = 0;
+  double seconds = 0;
+};
+
+// Called with every position reached while replaying, from several threads
+// at once
+typedef function<void(const BoardState& state, GameResult result)> PositionVisitor;
+
+// Replays every game in the files. Each file is mapped into memory and cut
+// into chunks at game boundaries, and the chunks are shared out between
+// num_threads workers. A game is replayed in two alternating positions, so
+// memory use doesn't grow with its length.
+PgnStats replay_pgn_files(const vector<string>& paths, int num_threads,
+  const PositionVisitor& visit = PositionVisitor());
+
+// Replays the files and prints how many games a second were got through
+void run_pgn_replay(const vector<string>& paths, int num_threads);
@@ -1,7 +1,14 @@
 #pragma once
+
+// Material, indexed by Piece
+static const int piece_values[] = { 100, 300, 300, 500, 900, 20000 };
+static const int bishop_pair_bonus = 20;
+// For a pawn one or two squares in front of its own king, before the endgame
+static const int king_shelter_bonus = 50;
+
 // These tables have been copied from https://www.chessprogramming.org/Simplified_Evaluation_Function
 
-int pawn_pst[] = {
+static const int pawn_pst[] = {
    0,  0,  0,  0,  0,  0,  0,  0,
   50, 50, 50, 50, 50, 50, 50, 50,
   10, 10, 20, 30, 30, 20, 10, 10,
@@ -12,7 +19,7 @@ int pawn_pst[] = {
    0,  0,  0,  0,  0,  0,  0,  0,
 };
 
-int knight_pst[] = {
+static const int knight_pst[] = {
   -50,-40,-30,-30,-30,-30,-40,-50,
   -40,-20,  0,  0,  0,  0,-20,-40,
   -30,  0, 10, 15, 15, 10,  0,-30,
@@ -23,7 +30,7 @@ int knight_pst[] = {
   -50,-40,-30,-30,-30,-30,-40,-50,
 };
 
-int bishop_pst[] = {
+static const int bishop_pst[] = {
   -20,-10,-10,-10,-10,-10,-10,-20,
   -10,  0,  0,  0,  0,  0,  0,-10,
   -10,  0,  5, 10, 10,  5,  0,-10,
@@ -34,7 +41,7 @@ int bishop_pst[] = {
   -20,-10, -10,-10,-10,-10,-10,-20,
 };
 
-int rook_pst[] = {
+static const int rook_pst[] = {
    0,  0,  0,  0,  0,  0,  0,  0,
    5, 10, 10, 10, 10, 10, 10,  5,
   -5,  0,  0,  0,  0,  0,  0, -5,
@@ -45,7 +52,7 @@ int rook_pst[] = {
    0,  0,  0,  5,  5,  0,  0,  0,
 };
 
-int queen_pst[] = {
+static const int queen_pst[] = {
   -20,-10,-10, -5, -5,-10,-10,-20,
   -10,  0,  0,  0,  0,  0,  0,-10,
   -10,  0,  5,  5,  5,  5,  0,-10,
@@ -56,7 +63,7 @@ int queen_pst[] = {
   -20,-10,-10, -5, -5,-10,-10,-20,
 };
 
-int king_mg_pst[] = {
+static const int king_mg_pst[] = {
   -30,-40,-40,-50,-50,-40,-40,-30,
   -30,-40,-40,-50,-50,-40,-40,-30,
   -30,-40,-40,-50,-50,-40,-40,-30,
@@ -67,7 +74,7 @@ int king_mg_pst[] = {
    20, 30, 10,  0,  0, 10, 30, 20,
 };
 
-int king_eg_pst[] = {
+static const int king_eg_pst[] = {
   -50,-40,-30,-20,-20,-30,-40,-50,
   -30,-20,-10,  0,  0,-10,-20,-30,
   -30,-10, 20, 30, 30, 20,-10,-30,
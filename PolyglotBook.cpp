@@ -0,0 +1,153 @@
+#include "PolyglotBook.h"
+#include "Zobrist.h"
+
+// Offsets into the Polyglot random table after the 12 * 64 piece keys
+constexpr int polyglot_castling_offset = 768;
+constexpr int polyglot_en_passant_offset = 772;
+constexpr int polyglot_turn_offset = 780;
+
+constexpr size_t book_entry_size = 16;
+
+static uint64_t read_big_endian(const uint8_t* p, int bytes)
+{
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; i++)
+    value = (value << 8) | p[i];
+  return value;
+}
+
+PolyglotBook::PolyglotBook()
+  : num_entries(0)
+  , rng(random_device()())
+{
+}
+
+bool PolyglotBook::open(const string& path)
+{
+  num_entries = 0;
+  if (!file.open(path))
+    return false;
+  num_entries = file.size() / book_entry_size;
+  return num_entries > 0;
+}
+
+bool PolyglotBook::ready() const
+{
+  return num_entries > 0;
+}
+
+uint64_t PolyglotBook::key(const BoardState& state) const
+{
+  uint64_t key = 0;
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      const Square& sq = state.board[y][x];
+      if (sq.occupancy == NONE)
+        continue;
+      // Polyglot interleaves colours: black pawn, white pawn, black knight...
+      const int kind = sq.occupancy * 2 + (sq.colour == WHITE ? 1 : 0);
+      key ^= polyglot_random64[64 * kind + 8 * y + x];
+    }
+  }
+
+  // Polyglot orders castling rights the same way as CastlingRight
+  for (int right = WHITE_KINGSIDE; right <= BLACK_QUEENSIDE; right++) {
+    if (state.has_castling_right(right))
+      key ^= polyglot_random64[polyglot_castling_offset + right];
+  }
+
+  // The en passant file only counts if a pawn is actually there to take it
+  const Coords& ep = state.en_passant_square();
+  if (ep.x >= 0) {
+    const PieceColour us = state.whites_turn ? WHITE : BLACK;
+    const int pawn_y = state.whites_turn ? ep.y - 1 : ep.y + 1;
+    for (int x = ep.x - 1; x <= ep.x + 1; x += 2) {
+      if (x < 0 || x > 7 || pawn_y < 0 || pawn_y > 7)
+        continue;
+      const Square& sq = state.board[pawn_y][x];
+      if (sq.occupancy == PAWN && sq.colour == us) {
+        key ^= polyglot_random64[polyglot_en_passant_offset + ep.x];
+        break;
+      }
+    }
+  }
+
+  if (state.whites_turn)
+    key ^= polyglot_random64[polyglot_turn_offset];
+  return key;
+}
+
+const Move* PolyglotBook::probe(const BoardState& state, BookSelection selection)
+{
+  if (!ready())
+    return nullptr;
+
+  const uint64_t target = key(state);
+  const uint8_t* entries = file.data();
+
+  // Find the first entry for this key
+  size_t low = 0, high = num_entries;
+  while (low < high) {
+    const size_t mid = low + (high - low) / 2;
+    if (read_big_endian(entries + mid * book_entry_size, 8) < target)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  const Move* candidates[64];
+  unsigned weights[64];
+  int num_candidates = 0;
+  unsigned total_weight = 0;
+
+  for (size_t i = low; i < num_entries && num_candidates < 64; i++) {
+    const uint8_t* entry = entries + i * book_entry_size;
+    if (read_big_endian(entry, 8) != target)
+      break;
+    const unsigned book_move = static_cast<unsigned>(read_big_endian(entry + 8, 2));
+    const unsigned weight = static_cast<unsigned>(read_big_endian(entry + 10, 2));
+
+    // Only queen promotions are generated, so skip underpromotions
+    const int promotion = (book_move >> 12) & 7;
+    if (promotion != 0 && promotion != 4)
+      continue;
+    Coords from((book_move >> 6) & 7, (book_move >> 9) & 7);
+    Coords to(book_move & 7, (book_move >> 3) & 7);
+
+    // Polyglot writes castling as the king capturing its own rook
+    const Square& moving = state.board[from.y][from.x];
+    if (moving.occupancy == KING && from.x == 4 && to.y == from.y &&
+        (to.x == 0 || to.x == 7)) {
+      to.x = to.x == 7 ? 6 : 2;
+    }
+
+    for (const Move& move : state.possible_moves) {
+      if (move.from == from && move.to == to) {
+        candidates[num_candidates] = &move;
+        weights[num_candidates] = weight;
+        num_candidates++;
+        total_weight += weight;
+        break;
+      }
+    }
+  }
+
+  if (num_candidates == 0)
+    return nullptr;
+
+  if (selection == BOOK_WEIGHTED && total_weight > 0) {
+    unsigned pick = uniform_int_distribution<unsigned>(0, total_weight - 1)(rng);
+    for (int i = 0; i < num_candidates; i++) {
+      if (pick < weights[i])
+        return candidates[i];
+      pick -= weights[i];
+    }
+  }
+
+  int best = 0;
+  for (int i = 1; i < num_candidates; i++) {
+    if (weights[i] > weights[best])
+      best = i;
+  }
+  return candidates[best];
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <string>
+
+#include "Chess.h"
+#include "MappedFile.h"
+
+using namespace std;
+
+enum BookSelection {
+  BOOK_BEST,     // Always play the highest weighted move
+  BOOK_WEIGHTED, // Pick at random in proportion to the weights
+};
+
+// Opening book in the Polyglot .bin format: 16-byte big-endian entries
+// sorted by position key, mapped into memory and binary searched. Keys are
+// computed from polyglot_random64 in Zobrist.h rather than zobrist_hash.
+class PolyglotBook {
+public:
+  PolyglotBook();
+  bool open(const string& path);
+  bool ready() const;
+  uint64_t key(const BoardState& state) const;
+  const Move* probe(const BoardState& state, BookSelection selection);
+private:
+  MappedFile file;
+  size_t num_entries;
+  mt19937 rng;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Chess.h"
+#include "SearchStats.h"
+#include "TranspositionTable.h"
+
+using namespace std;
+
+// Everything a search writes to apart from its transposition table: its
+// limits, counters and statistics. A context runs one search at a time, so
+// each thread searching needs its own, but any number of contexts can
+// share a table. Nothing here is global, so independent engines can live
+// side by side in one process.
+class SearchContext {
+public:
+  explicit SearchContext(TranspositionTable& shared_table) : table(shared_table) {}
+  bool stopped() const
+  {
+    return (limits.nodes && nodes >= limits.nodes) ||
+      (limits.stop && limits.stop->load(memory_order_relaxed));
+  }
+  bool abandoned() const
+  {
+    return abandon && abandon->load(memory_order_relaxed);
+  }
+
+  TranspositionTable& table;
+  SearchLimits limits;
+  // Set along with limits.stop when nobody wants the search's result, which
+  // find_best_move() then doesn't report
+  const atomic<bool>* abandon = nullptr;
+  // Reset at the start of every search
+  SearchStats stats;
+  uint64_t nodes = 0;     // Nodes searched, an abandoned iteration's included
+  uint64_t positions = 0; // Positions made by the search
+  uint64_t tablebase_hits = 0;
+  IterationStats* iteration = nullptr; // The iteration being searched
+};
@@ -0,0 +1,82 @@
+#include "SearchStats.h"
+
+IterationStats::IterationStats(int search_depth)
+  : depth(search_depth)
+  , nodes(0)
+  , leaf_nodes(0)
+  , positions(0)
+  , tt_probes(0)
+  , tt_hits(0)
+  , tt_cutoffs(0)
+  , beta_cutoffs(0)
+  , first_move_cutoffs(0)
+  , tablebase_hits(0)
+  , best_score(0)
+  , seconds(0)
+{
+}
+
+void SearchStats::clear()
+{
+  iterations.clear();
+  best_move.clear();
+  seconds = 0;
+}
+
+double SearchStats::branching_factor(size_t iteration) const
+{
+  if (iteration == 0 || iterations[iteration - 1].nodes == 0)
+    return 0;
+  return static_cast<double>(iterations[iteration].nodes) / iterations[iteration - 1].nodes;
+}
+
+double SearchStats::first_move_cutoff_rate(size_t iteration) const
+{
+  const IterationStats& it = iterations[iteration];
+  return it.beta_cutoffs ? static_cast<double>(it.first_move_cutoffs) / it.beta_cutoffs : 0;
+}
+
+uint64_t SearchStats::total_nodes() const
+{
+  uint64_t nodes = 0;
+  for (const IterationStats& it : iterations)
+    nodes += it.nodes;
+  return nodes;
+}
+
+// One JSON object on a single line, so successive searches can be appended
+// to the same file and read back line by line
+void SearchStats::write_json(ostream& out) const
+{
+  out << "{\"best_move\":\"" << best_move << "\",\"seconds\":" << seconds <<
+    ",\"nodes\":" << total_nodes() << ",\"iterations\":[";
+  for (size_t i = 0; i < iterations.size(); i++) {
+    const IterationStats& it = iterations[i];
+    out << (i ? "," : "") << "{\"depth\":" << it.depth <<
+      ",\"nodes\":" << it.nodes <<
+      ",\"leaf_nodes\":" << it.leaf_nodes <<
+      ",\"positions\":" << it.positions <<
+      ",\"tt_probes\":" << it.tt_probes <<
+      ",\"tt_hits\":" << it.tt_hits <<
+      ",\"tt_cutoffs\":" << it.tt_cutoffs <<
+      ",\"beta_cutoffs\":" << it.beta_cutoffs <<
+      ",\"first_move_cutoffs\":" << it.first_move_cutoffs <<
+      ",\"first_move_cutoff_rate\":" << first_move_cutoff_rate(i) <<
+      ",\"branching_factor\":" << branching_factor(i) <<
+      ",\"tablebase_hits\":" << it.tablebase_hits <<
+      ",\"best_score\":" << it.best_score <<
+      ",\"seconds\":" << it.seconds;
+    if (!it.lines.empty()) {
+      out << ",\"lines\":[";
+      for (size_t j = 0; j < it.lines.size(); j++) {
+        out << (j ? "," : "") << "{\"score\":" << it.lines[j].score << ",\"pv\":[";
+        for (size_t k = 0; k < it.lines[j].moves.size(); k++)
+          out << (k ? "," : "") << "\"" << it.lines[j].moves[k] << "\"";
+        out << "]}";
+      }
+      out << "]";
+    }
+    out << "}";
+  }
+  out << "]}\n";
+}
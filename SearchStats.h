@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// One of the best root moves found by an iteration, with its line of play
+class PrincipalVariation {
+public:
+  int score;
+  vector<string> moves;
+};
+
+// Counters for one iteration of iterative deepening
+class IterationStats {
+public:
+  IterationStats(int search_depth = 0);
+  int depth;
+  uint64_t nodes;              // Positions searched, root moves included
+  uint64_t leaf_nodes;         // Nodes scored by the static evaluation
+  uint64_t positions;          // Positions made, searched or not
+  uint64_t tt_probes;
+  uint64_t tt_hits;            // Entries found at a sufficient depth
+  uint64_t tt_cutoffs;         // Hits that settled the node on their own
+  uint64_t beta_cutoffs;
+  uint64_t first_move_cutoffs; // Beta cutoffs caused by the first move tried
+  uint64_t tablebase_hits;
+  int best_score;
+  double seconds;
+  vector<PrincipalVariation> lines; // Best first; only filled in for MultiPV
+};
+
+class SearchStats {
+public:
+  void clear();
+  // Nodes in this iteration over nodes in the one before, or 0 for the first
+  double branching_factor(size_t iteration) const;
+  double first_move_cutoff_rate(size_t iteration) const;
+  uint64_t total_nodes() const;
+  void write_json(ostream& out) const;
+
+  vector<IterationStats> iterations;
+  string best_move;
+  double seconds;
+};
@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#include "SearchContext.h"
+#include "SelfPlay.h"
+#include "TrainingData.h"
+#include "TranspositionTable.h"
+#include "Utils.h"
+
+// Each thread's own table. Games are short, shallow searches.
+constexpr size_t self_play_table_megabytes = 16;
+// A score this far from even for this many plies in a row decides the
+// game, as the engine would resign
+constexpr int adjudication_score = 1000;
+constexpr int adjudication_plies = 4;
+constexpr int mate_threshold = 9000;
+
+class SelfPlayStats {
+public:
+  uint64_t games = 0;
+  uint64_t positions = 0;
+  uint64_t results[4] = {}; // By GameResult
+};
+
+// What one thread keeps from game to game
+class SelfPlayWorker {
+public:
+  SelfPlayWorker(const SelfPlaySettings& settings, TrainingDataWriter& writer, mutex& book_mutex);
+  void play(uint64_t game_index);
+
+  SelfPlayStats stats;
+private:
+  GameResult game_over(const BoardState& state) const;
+
+  const SelfPlaySettings& settings;
+  TrainingDataWriter& writer;
+  mutex& book_mutex;
+  TranspositionTable table;
+  SearchContext context;
+  // Reserved up front, so the positions never move and each can point at
+  // the one before for the repetition check
+  vector<BoardState> positions;
+  vector<PackedPosition> records;
+};
+
+SelfPlayWorker::SelfPlayWorker(const SelfPlaySettings& settings, TrainingDataWriter& writer,
+  mutex& book_mutex)
+  : settings(settings)
+  , writer(writer)
+  , book_mutex(book_mutex)
+  , table(self_play_table_megabytes)
+  , context(table)
+{
+  context.limits = settings.limits;
+  positions.reserve(settings.max_plies + 1);
+  records.reserve(settings.max_plies);
+}
+
+// The position's result if the game is over there. A position that has
+// been seen twice before is drawn, and has no moves, even if its side to
+// move is in check.
+GameResult SelfPlayWorker::game_over(const BoardState& state) const
+{
+  if (!state.possible_moves.empty())
+    return RESULT_UNKNOWN;
+  int repetitions = 0;
+  for (const BoardState& earlier : positions)
+    repetitions += earlier.zobrist_hash == state.zobrist_hash;
+  if (repetitions < 3 && state.side_to_move_lost())
+    return state.whites_turn ? RESULT_BLACK_WIN : RESULT_WHITE_WIN;
+  return RESULT_DRAW;
+}
+
+static bool is_capture(const BoardState& state, const Move& move)
+{
+  const Square& moving = state.board[move.from.y][move.from.x];
+  return state.board[move.to.y][move.to.x].occupancy != NONE ||
+    (moving.occupancy == PAWN && move.from.x != move.to.x);
+}
+
+void SelfPlayWorker::play(uint64_t game_index)
+{
+  mt19937_64 rng(settings.seed + game_index);
+  table.clear();
+  positions.clear();
+  records.clear();
+  positions.emplace_back();
+
+  GameResult result = RESULT_UNKNOWN;
+  bool in_book = settings.book != nullptr;
+  int random_plies_left = settings.random_plies;
+  GameResult leader = RESULT_UNKNOWN;
+  int decisive_plies = 0;
+  for (int ply = 0; ; ply++) {
+    BoardState& state = positions.back();
+    result = game_over(state);
+    if (result != RESULT_UNKNOWN)
+      break;
+    if (ply == settings.max_plies) {
+      result = RESULT_DRAW;
+      break;
+    }
+
+    const Move* move = nullptr;
+    if (in_book) {
+      lock_guard<mutex> lock(book_mutex);
+      move = settings.book->probe(state, BOOK_WEIGHTED);
+      in_book = move != nullptr;
+    }
+    if (!move && random_plies_left > 0) {
+      random_plies_left--;
+      move = &state.possible_moves[rng() % state.possible_moves.size()];
+    }
+    if (!move) {
+      int score;
+      move = state.search(context, score);
+      const int white_score = state.whites_turn ? score : -score;
+      if (abs(score) < mate_threshold && !state.in_check(state.whites_turn ? WHITE : BLACK)) {
+        records.emplace_back();
+        pack_position(state, white_score, ply, is_capture(state, *move), records.back());
+      }
+      if (abs(white_score) >= adjudication_score) {
+        const GameResult winning = white_score > 0 ? RESULT_WHITE_WIN : RESULT_BLACK_WIN;
+        decisive_plies = winning == leader ? decisive_plies + 1 : 1;
+        leader = winning;
+      } else {
+        decisive_plies = 0;
+      }
+      if (decisive_plies == adjudication_plies) {
+        result = leader;
+        break;
+      }
+    }
+    positions.emplace_back(&state, move);
+  }
+
+  for (PackedPosition& record : records)
+    record.result = static_cast<uint8_t>(result);
+  writer.write(records.data(), records.size());
+  stats.games++;
+  stats.positions += records.size();
+  stats.results[result]++;
+}
+
+int run_self_play(const SelfPlaySettings& settings)
+{
+  TrainingDataWriter writer;
+  if (!writer.open(settings.path)) {
+    cout << "Failed to open " << settings.path << " for writing\n";
+    return 1;
+  }
+  PolyglotBook* const book = settings.book && settings.book->ready() ? settings.book : nullptr;
+  SelfPlaySettings shared = settings;
+  shared.book = book;
+  shared.limits.stop = nullptr;
+  shared.limits.on_iteration = nullptr;
+
+  Timer timer;
+  mutex book_mutex;
+  atomic<uint64_t> next_game(0);
+  const int num_threads = max(1, settings.num_threads);
+  vector<SelfPlayStats> thread_stats(num_threads);
+  vector<thread> workers;
+  for (int i = 0; i < num_threads; i++) {
+    workers.emplace_back([&, i] {
+      SelfPlayWorker worker(shared, writer, book_mutex);
+      for (uint64_t game = next_game++; game < shared.games; game = next_game++)
+        worker.play(game);
+      thread_stats[i] = worker.stats;
+    });
+  }
+  for (thread& worker : workers)
+    worker.join();
+
+  SelfPlayStats total;
+  for (const SelfPlayStats& stats : thread_stats) {
+    total.games += stats.games;
+    total.positions += stats.positions;
+    for (int i = 0; i < 4; i++)
+      total.results[i] += stats.results[i];
+  }
+  const double seconds = max(timer.elapsed(), 1e-9);
+  cout << "Played " << total.games << " games (+" << total.results[RESULT_WHITE_WIN] <<
+    " =" << total.results[RESULT_DRAW] << " -" << total.results[RESULT_BLACK_WIN] <<
+    " for white) on " << num_threads << " threads in " << seconds << " seconds\n";
+  cout << "Wrote " << total.positions << " positions to " << settings.path << ": " <<
+    static_cast<uint64_t>(total.positions / seconds) << " positions/s, " <<
+    total.games / seconds << " games/s\n";
+  return 0;
+}
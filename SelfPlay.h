@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Chess.h"
+#include "PolyglotBook.h"
+
+using namespace std;
+
+class SelfPlaySettings {
+public:
+  string path;               // Where the records are written
+  uint64_t games = 100;
+  int num_threads = 1;
+  // Each game leaves the book, if there is one, then plays this many
+  // random moves before the engine takes over
+  int random_plies = 8;
+  uint64_t seed = 1;         // Game n's random moves come from seed + n
+  int max_plies = 400;       // Longer games are drawn
+  SearchLimits limits;       // For every move searched
+  PolyglotBook* book = nullptr;
+};
+
+// Plays games of the engine against itself on num_threads threads at once
+// and writes a training record for every position it searched, labelled
+// with the search score and the game's result. Positions in check and
+// those with a forced mate in sight are left out.
+//
+// Every thread searches a table of its own, cleared before each game, and
+// keeps its buffers from one game to the next, so threads only meet to
+// take the next game and to write a finished one. With a depth or node
+// limit, a game played from random moves alone is the same every time.
+//
+// Returns nonzero if the file can't be written.
+int run_self_play(const SelfPlaySettings& settings);
@@ -0,0 +1,186 @@
+#include "Socket.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+static const uintptr_t invalid_handle = ~static_cast<uintptr_t>(0);
+
+#ifdef _WIN32
+typedef SOCKET NativeSocket;
+#else
+typedef int NativeSocket;
+#endif
+
+static NativeSocket native(uintptr_t handle)
+{
+  return static_cast<NativeSocket>(handle);
+}
+
+static bool open_socket(uintptr_t& handle)
+{
+#ifdef _WIN32
+  static const bool started = [] {
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+  }();
+  if (!started)
+    return false;
+#endif
+  const NativeSocket s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+#ifdef _WIN32
+  if (s == INVALID_SOCKET)
+    return false;
+#else
+  if (s < 0)
+    return false;
+#endif
+  handle = static_cast<uintptr_t>(s);
+  return true;
+}
+
+static sockaddr_in loopback_address(int port)
+{
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<uint16_t>(port));
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return address;
+}
+
+// Progress lines are small and latency matters more than packet count
+static void disable_nagle(uintptr_t handle)
+{
+  int on = 1;
+  setsockopt(native(handle), IPPROTO_TCP, TCP_NODELAY,
+    reinterpret_cast<const char*>(&on), sizeof(on));
+}
+
+Socket::Socket()
+  : handle(invalid_handle)
+{
+}
+
+Socket::~Socket()
+{
+  close();
+}
+
+bool Socket::listen(int port)
+{
+  close();
+  if (!open_socket(handle))
+    return false;
+  int on = 1;
+  setsockopt(native(handle), SOL_SOCKET, SO_REUSEADDR,
+    reinterpret_cast<const char*>(&on), sizeof(on));
+  const sockaddr_in address = loopback_address(port);
+  if (::bind(native(handle), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+      ::listen(native(handle), SOMAXCONN) != 0) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool Socket::accept(Socket& client)
+{
+  client.close();
+  const NativeSocket s = ::accept(native(handle), nullptr, nullptr);
+#ifdef _WIN32
+  if (s == INVALID_SOCKET)
+    return false;
+#else
+  if (s < 0)
+    return false;
+#endif
+  client.handle = static_cast<uintptr_t>(s);
+  disable_nagle(client.handle);
+  return true;
+}
+
+bool Socket::connect(int port)
+{
+  close();
+  if (!open_socket(handle))
+    return false;
+  const sockaddr_in address = loopback_address(port);
+  if (::connect(native(handle), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+    close();
+    return false;
+  }
+  disable_nagle(handle);
+  return true;
+}
+
+bool Socket::send_all(const string& data)
+{
+#ifdef MSG_NOSIGNAL
+  // A client hanging up mid-reply must not kill the server with SIGPIPE
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  size_t sent = 0;
+  while (sent < data.size()) {
+    const int n = static_cast<int>(::send(native(handle), data.data() + sent,
+      static_cast<int>(data.size() - sent), flags));
+    if (n <= 0)
+      return false;
+    sent += n;
+  }
+  return true;
+}
+
+bool Socket::read_line(string& line)
+{
+  size_t newline;
+  while ((newline = buffer.find('\n')) == string::npos) {
+    char chunk[4096];
+    const int n = static_cast<int>(::recv(native(handle), chunk, sizeof(chunk), 0));
+    if (n <= 0)
+      return false;
+    buffer.append(chunk, n);
+  }
+  line = buffer.substr(0, newline);
+  buffer.erase(0, newline + 1);
+  if (!line.empty() && line.back() == '\r')
+    line.pop_back();
+  return true;
+}
+
+void Socket::shutdown()
+{
+  if (handle == invalid_handle)
+    return;
+#ifdef _WIN32
+  ::shutdown(native(handle), SD_BOTH);
+#else
+  ::shutdown(native(handle), SHUT_RDWR);
+#endif
+}
+
+void Socket::close()
+{
+  if (handle == invalid_handle)
+    return;
+#ifdef _WIN32
+  closesocket(native(handle));
+#else
+  ::close(native(handle));
+#endif
+  handle = invalid_handle;
+  buffer.clear();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+using namespace std;
+
+// A blocking TCP socket on the loopback interface, just enough for the
+// analysis server and its load generator to exchange lines of text
+class Socket {
+public:
+  Socket();
+  ~Socket();
+  Socket(const Socket&) = delete;
+  Socket& operator=(const Socket&) = delete;
+  bool listen(int port);
+  bool accept(Socket& client);
+  bool connect(int port);
+  bool send_all(const string& data);
+  // Reads up to the next newline, which is dropped along with any '\r'
+  bool read_line(string& line);
+  // Wakes a thread blocked reading, leaving the handle for it to close
+  void shutdown();
+  void close();
+private:
+  uintptr_t handle;
+  string buffer;
+};
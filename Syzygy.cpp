@@ -0,0 +1,1038 @@
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "MappedFile.h"
+#include "Syzygy.h"
+
+// The table format and indexing scheme follow Ronald de Man's Syzygy
+// generator. Pieces are coded as in the files: white pawn to king are 1-6,
+// black pieces are the same plus 8. Squares are y * 8 + x.
+
+constexpr int TB_PIECES = 7;
+
+enum TBType {
+  TB_WDL,
+  TB_DTZ,
+};
+
+enum TBFlag {
+  TB_FLAG_STM = 1,
+  TB_FLAG_MAPPED = 2,
+  TB_FLAG_WIN_PLIES = 4,
+  TB_FLAG_LOSS_PLIES = 8,
+  TB_FLAG_WIDE = 16,
+  TB_FLAG_SINGLE_VALUE = 128,
+};
+
+enum ProbeState {
+  PROBE_FAIL,
+  PROBE_OK,
+  PROBE_CHANGE_STM,        // DTZ is stored for the other side to move
+  PROBE_ZEROING_BEST_MOVE, // The best move is a capture or pawn move
+};
+
+static uint16_t read_le16(const uint8_t* p)
+{
+  return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
+
+static uint32_t read_le32(const uint8_t* p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static uint32_t read_be32(const uint8_t* p)
+{
+  return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static uint64_t read_be64(const uint8_t* p)
+{
+  return static_cast<uint64_t>(read_be32(p)) << 32 | read_be32(p + 4);
+}
+
+static int file_of(int sq) { return sq & 7; }
+static int rank_of(int sq) { return sq >> 3; }
+
+// Positive above the a1-h8 diagonal, negative below it
+static int off_a1h8(int sq) { return rank_of(sq) - file_of(sq); }
+
+// Huffman-coded, pair-compressed values of one table, side and pawn file
+class PairsData {
+public:
+  uint8_t flags;
+  size_t block_size;
+  size_t span;
+  uint32_t num_blocks;
+  int max_sym_len;
+  int min_sym_len;
+  const uint8_t* lowest_sym;   // 16-bit symbol per code length
+  const uint8_t* btree;        // 3 bytes per symbol, the pair it expands to
+  const uint8_t* block_length; // 16-bit count of values in each block, less one
+  uint32_t block_length_size;
+  const uint8_t* sparse_index; // 32-bit block and 16-bit offset every span values
+  size_t sparse_index_size;
+  const uint8_t* data;
+  vector<uint64_t> base64;
+  vector<uint8_t> symlen;
+  uint8_t pieces[TB_PIECES];
+  uint64_t group_idx[TB_PIECES + 1];
+  int group_len[TB_PIECES + 1];
+  uint16_t map_idx[4];
+};
+
+static int btree_left(const PairsData* d, int sym)
+{
+  const uint8_t* lr = d->btree + 3 * sym;
+  return (lr[1] & 0xF) << 8 | lr[0];
+}
+
+static int btree_right(const PairsData* d, int sym)
+{
+  const uint8_t* lr = d->btree + 3 * sym;
+  return lr[2] << 4 | lr[1] >> 4;
+}
+
+class TBTable {
+public:
+  TBTable(const string& table_code, TBType table_type);
+  PairsData* get(int stm, int file)
+  {
+    return &items[stm % sides][has_pawns ? file : 0];
+  }
+
+  TBType type;
+  string code;
+  uint64_t key;
+  uint64_t key2;
+  int piece_count;
+  int sides;
+  bool has_pawns;
+  bool has_unique_pieces;
+  uint8_t pawn_count[2]; // Leading side's pawns first
+  PairsData items[2][4];
+  const uint8_t* map;
+  MappedFile file;
+  atomic<bool> ready;
+  mutex init_mutex;
+};
+
+static uint64_t tb_material_key(const int white[6], const int black[6])
+{
+  uint64_t key = 0;
+  for (int piece = PAWN; piece <= QUEEN; piece++) {
+    key |= static_cast<uint64_t>(white[piece]) << (4 * piece + 20);
+    key |= static_cast<uint64_t>(black[piece]) << (4 * piece);
+  }
+  return key;
+}
+
+TBTable::TBTable(const string& table_code, TBType table_type)
+  : type(table_type)
+  , code(table_code)
+  , piece_count(0)
+  , sides(table_type == TB_WDL ? 2 : 1)
+  , has_unique_pieces(false)
+  , items()
+  , map(nullptr)
+  , ready(false)
+{
+  static const string piece_letters = "PNBRQK";
+  int counts[2][6] = { 0 };
+  int side = 0;
+  for (char c : code) {
+    if (c == 'v') {
+      side = 1;
+      continue;
+    }
+    counts[side][piece_letters.find(c)]++;
+    piece_count++;
+  }
+  has_pawns = counts[0][PAWN] || counts[1][PAWN];
+  for (int c = 0; c < 2; c++) {
+    for (int piece = PAWN; piece < KING; piece++) {
+      if (counts[c][piece] == 1)
+        has_unique_pieces = true;
+    }
+  }
+  // The side with fewer pawns leads, as that compresses better
+  const bool white_leads = !counts[1][PAWN] ||
+    (counts[0][PAWN] && counts[1][PAWN] >= counts[0][PAWN]);
+  pawn_count[0] = counts[white_leads ? 0 : 1][PAWN];
+  pawn_count[1] = counts[white_leads ? 1 : 0][PAWN];
+  key = tb_material_key(counts[0], counts[1]);
+  key2 = tb_material_key(counts[1], counts[0]);
+}
+
+static vector<string> tb_paths;
+static vector<unique_ptr<TBTable>> tb_tables;
+static unordered_map<uint64_t, pair<TBTable*, TBTable*>> tb_by_key;
+static int tb_max_pieces;
+
+static uint64_t binomial[6][64];
+static int map_pawns[64];
+static int map_b1h1h7[64];
+static int map_a1d1d4[64];
+static int map_kk[10][64];
+static int lead_pawn_idx[6][64];
+static uint64_t lead_pawns_size[6][4];
+
+static void init_index_tables()
+{
+  // map_b1h1h7 numbers the squares below the a1-h8 diagonal 0-27
+  int code = 0;
+  for (int sq = 0; sq < 64; sq++) {
+    if (off_a1h8(sq) < 0)
+      map_b1h1h7[sq] = code++;
+  }
+
+  // map_a1d1d4 numbers the a1-d1-d4 triangle 0-9, diagonal squares last
+  vector<int> diagonal;
+  code = 0;
+  for (int sq = 0; sq <= 27; sq++) {
+    if (off_a1h8(sq) < 0 && file_of(sq) <= 3)
+      map_a1d1d4[sq] = code++;
+    else if (!off_a1h8(sq) && file_of(sq) <= 3)
+      diagonal.push_back(sq);
+  }
+  for (int sq : diagonal)
+    map_a1d1d4[sq] = code++;
+
+  // map_kk numbers the legal placements of two kings with the first in the
+  // a1-d1-d4 triangle, both-on-the-diagonal placements last
+  vector<pair<int, int>> both_on_diagonal;
+  code = 0;
+  for (int idx = 0; idx < 10; idx++) {
+    for (int s1 = 0; s1 <= 27; s1++) {
+      if (map_a1d1d4[s1] != idx || (!idx && s1 != 1))
+        continue;
+      for (int s2 = 0; s2 < 64; s2++) {
+        if (max(abs(file_of(s1) - file_of(s2)), abs(rank_of(s1) - rank_of(s2))) <= 1)
+          continue;
+        if (!off_a1h8(s1) && off_a1h8(s2) > 0)
+          continue;
+        if (!off_a1h8(s1) && !off_a1h8(s2))
+          both_on_diagonal.emplace_back(idx, s2);
+        else
+          map_kk[idx][s2] = code++;
+      }
+    }
+  }
+  for (auto& p : both_on_diagonal)
+    map_kk[p.first][p.second] = code++;
+
+  binomial[0][0] = 1;
+  for (int n = 1; n < 64; n++) {
+    for (int k = 0; k < 6 && k <= n; k++) {
+      binomial[k][n] = (k > 0 ? binomial[k - 1][n - 1] : 0) +
+        (k < n ? binomial[k][n - 1] : 0);
+    }
+  }
+
+  // map_pawns numbers a2-h7 so that the leading pawn, nearest the edge and
+  // lowest on its file, has the highest value
+  int available_squares = 47;
+  for (int lead_pawns_count = 1; lead_pawns_count <= 5; lead_pawns_count++) {
+    for (int f = 0; f <= 3; f++) {
+      int idx = 0;
+      for (int r = 1; r <= 6; r++) {
+        const int sq = r * 8 + f;
+        if (lead_pawns_count == 1) {
+          map_pawns[sq] = available_squares--;
+          map_pawns[sq ^ 7] = available_squares--;
+        }
+        lead_pawn_idx[lead_pawns_count][sq] = idx;
+        idx += static_cast<int>(binomial[lead_pawns_count - 1][map_pawns[sq]]);
+      }
+      lead_pawns_size[lead_pawns_count][f] = idx;
+    }
+  }
+}
+
+static bool pawns_comp(int a, int b)
+{
+  return map_pawns[a] < map_pawns[b];
+}
+
+static uint8_t set_symlen(PairsData* d, int sym, vector<bool>& visited)
+{
+  visited[sym] = true;
+  const int right = btree_right(d, sym);
+  if (right == 0xFFF)
+    return 0;
+  const int left = btree_left(d, sym);
+  if (!visited[left])
+    d->symlen[left] = set_symlen(d, left, visited);
+  if (!visited[right])
+    d->symlen[right] = set_symlen(d, right, visited);
+  return d->symlen[left] + d->symlen[right] + 1;
+}
+
+static const uint8_t* set_sizes(PairsData* d, const uint8_t* data)
+{
+  d->flags = *data++;
+  if (d->flags & TB_FLAG_SINGLE_VALUE) {
+    d->num_blocks = 0;
+    d->span = d->sparse_index_size = 0;
+    d->min_sym_len = *data++; // The single value
+    return data;
+  }
+
+  // group_len is zero-terminated and the matching group_idx is the table size
+  const uint64_t tb_size =
+    d->group_idx[find(d->group_len, d->group_len + TB_PIECES, 0) - d->group_len];
+  d->block_size = static_cast<size_t>(1) << *data++;
+  d->span = static_cast<size_t>(1) << *data++;
+  d->sparse_index_size = static_cast<size_t>((tb_size + d->span - 1) / d->span);
+  const uint8_t padding = *data++;
+  d->num_blocks = read_le32(data);
+  data += 4;
+  // Padded so the sparse index can't point past the end
+  d->block_length_size = d->num_blocks + padding;
+  d->max_sym_len = *data++;
+  d->min_sym_len = *data++;
+  d->lowest_sym = data;
+  d->base64.assign(d->max_sym_len - d->min_sym_len + 1, 0);
+
+  // Canonical Huffman code: longer codes have lower values, so build the
+  // lowest 64-bit left-aligned code of each length
+  for (int i = static_cast<int>(d->base64.size()) - 2; i >= 0; i--) {
+    d->base64[i] = (d->base64[i + 1] + read_le16(d->lowest_sym + 2 * i) -
+      read_le16(d->lowest_sym + 2 * (i + 1))) / 2;
+  }
+  for (size_t i = 0; i < d->base64.size(); i++)
+    d->base64[i] <<= 64 - i - d->min_sym_len;
+
+  data += d->base64.size() * 2;
+  d->symlen.resize(read_le16(data));
+  data += 2;
+  d->btree = data;
+
+  // Each symbol stands for a pair of symbols, recursively; count the values
+  // each expands to
+  vector<bool> visited(d->symlen.size());
+  for (size_t sym = 0; sym < d->symlen.size(); sym++) {
+    if (!visited[sym])
+      d->symlen[sym] = set_symlen(d, static_cast<int>(sym), visited);
+  }
+  return data + d->symlen.size() * 3 + (d->symlen.size() & 1);
+}
+
+static const uint8_t* set_dtz_map(TBTable& e, const uint8_t* data, int max_file)
+{
+  if (e.type != TB_DTZ)
+    return data;
+  e.map = data;
+  for (int f = 0; f <= max_file; f++) {
+    PairsData* d = e.get(0, f);
+    if (!(d->flags & TB_FLAG_MAPPED))
+      continue;
+    if (d->flags & TB_FLAG_WIDE) {
+      data += reinterpret_cast<uintptr_t>(data) & 1;
+      for (int i = 0; i < 4; i++) {
+        d->map_idx[i] = static_cast<uint16_t>((data - e.map) / 2 + 1);
+        data += 2 * read_le16(data) + 2;
+      }
+    } else {
+      for (int i = 0; i < 4; i++) {
+        d->map_idx[i] = static_cast<uint16_t>(data - e.map + 1);
+        data += *data + 1;
+      }
+    }
+  }
+  return data + (reinterpret_cast<uintptr_t>(data) & 1);
+}
+
+// The pieces are encoded in groups: the leading pawns or pieces, the other
+// side's pawns, then runs of identical pieces. Each group gets a stride in
+// the index, in the order given by the file.
+static void set_groups(TBTable& e, PairsData* d, const int order[2], int f)
+{
+  int n = 0;
+  int first_len = e.has_pawns ? 0 : e.has_unique_pieces ? 3 : 2;
+  d->group_len[n] = 1;
+  for (int i = 1; i < e.piece_count; i++) {
+    if (--first_len > 0 || d->pieces[i] == d->pieces[i - 1])
+      d->group_len[n]++;
+    else
+      d->group_len[++n] = 1;
+  }
+  d->group_len[++n] = 0;
+
+  const bool pawns_on_both_sides = e.has_pawns && e.pawn_count[1];
+  int next = pawns_on_both_sides ? 2 : 1;
+  int free_squares = 64 - d->group_len[0] -
+    (pawns_on_both_sides ? d->group_len[1] : 0);
+  uint64_t idx = 1;
+  for (int k = 0; next < n || k == order[0] || k == order[1]; k++) {
+    if (k == order[0]) {
+      d->group_idx[0] = idx;
+      idx *= e.has_pawns ? lead_pawns_size[d->group_len[0]][f]
+        : e.has_unique_pieces ? 31332 : 462;
+    } else if (k == order[1]) {
+      d->group_idx[1] = idx;
+      idx *= binomial[d->group_len[1]][48 - d->group_len[0]];
+    } else {
+      d->group_idx[next] = idx;
+      idx *= binomial[d->group_len[next]][free_squares];
+      free_squares -= d->group_len[next++];
+    }
+  }
+  d->group_idx[n] = idx;
+}
+
+static void init_table(TBTable& e, const uint8_t* data)
+{
+  data++; // Flags, implied by the table's name
+  const int max_file = e.has_pawns ? 3 : 0;
+  const int sides = e.sides == 2 && e.key != e.key2 ? 2 : 1;
+  const bool pawns_on_both_sides = e.has_pawns && e.pawn_count[1];
+
+  for (int f = 0; f <= max_file; f++) {
+    const int order[2][2] = {
+      { *data & 0xF, pawns_on_both_sides ? *(data + 1) & 0xF : 0xF },
+      { *data >> 4, pawns_on_both_sides ? *(data + 1) >> 4 : 0xF },
+    };
+    data += 1 + pawns_on_both_sides;
+    for (int k = 0; k < e.piece_count; k++, data++) {
+      for (int i = 0; i < sides; i++)
+        e.get(i, f)->pieces[k] = i ? *data >> 4 : *data & 0xF;
+    }
+    for (int i = 0; i < sides; i++)
+      set_groups(e, e.get(i, f), order[i], f);
+  }
+  data += reinterpret_cast<uintptr_t>(data) & 1;
+
+  for (int f = 0; f <= max_file; f++) {
+    for (int i = 0; i < sides; i++)
+      data = set_sizes(e.get(i, f), data);
+  }
+  data = set_dtz_map(e, data, max_file);
+
+  for (int f = 0; f <= max_file; f++) {
+    for (int i = 0; i < sides; i++) {
+      PairsData* d = e.get(i, f);
+      d->sparse_index = data;
+      data += d->sparse_index_size * 6;
+    }
+  }
+  for (int f = 0; f <= max_file; f++) {
+    for (int i = 0; i < sides; i++) {
+      PairsData* d = e.get(i, f);
+      d->block_length = data;
+      data += d->block_length_size * 2;
+    }
+  }
+  for (int f = 0; f <= max_file; f++) {
+    for (int i = 0; i < sides; i++) {
+      data = reinterpret_cast<const uint8_t*>(
+        (reinterpret_cast<uintptr_t>(data) + 0x3F) & ~static_cast<uintptr_t>(0x3F));
+      PairsData* d = e.get(i, f);
+      d->data = data;
+      data += d->num_blocks * d->block_size;
+    }
+  }
+}
+
+#ifdef _WIN32
+static const char path_separator = ';';
+#else
+static const char path_separator = ':';
+#endif
+
+static bool open_table(TBTable& e)
+{
+  static const uint8_t magics[2][4] = {
+    { 0x71, 0xE8, 0x23, 0x5D },
+    { 0xD7, 0x66, 0x0C, 0xA5 },
+  };
+  const string name = e.code + (e.type == TB_WDL ? ".rtbw" : ".rtbz");
+  for (const string& dir : tb_paths) {
+    if (!e.file.open(dir + "/" + name))
+      continue;
+    if (e.file.size() % 64 != 16 ||
+        memcmp(e.file.data(), magics[e.type], 4) != 0) {
+      e.file.close();
+      return false;
+    }
+    init_table(e, e.file.data() + 4);
+    return true;
+  }
+  return false;
+}
+
+// Tables are mapped lazily, once, by whichever thread probes them first
+static bool table_mapped(TBTable& e)
+{
+  if (e.ready.load(memory_order_acquire))
+    return e.file.data() != nullptr;
+  lock_guard<mutex> lock(e.init_mutex);
+  if (!e.ready.load(memory_order_relaxed)) {
+    open_table(e);
+    e.ready.store(true, memory_order_release);
+  }
+  return e.file.data() != nullptr;
+}
+
+static int decompress_pairs(PairsData* d, uint64_t idx)
+{
+  if (d->flags & TB_FLAG_SINGLE_VALUE)
+    return d->min_sym_len;
+
+  // Find the block holding idx from the nearest sparse index entry
+  const uint8_t* sparse_entry = d->sparse_index + 6 * (idx / d->span);
+  uint32_t block = read_le32(sparse_entry);
+  int offset = read_le16(sparse_entry + 4);
+  offset += static_cast<int>(idx % d->span) - static_cast<int>(d->span / 2);
+  while (offset < 0)
+    offset += read_le16(d->block_length + 2 * --block) + 1;
+  while (offset > read_le16(d->block_length + 2 * block))
+    offset -= read_le16(d->block_length + 2 * block++) + 1;
+
+  const uint8_t* ptr = d->data + static_cast<uint64_t>(block) * d->block_size;
+  uint64_t buf64 = read_be64(ptr);
+  ptr += 8;
+  int buf64_size = 64;
+  int sym;
+  while (true) {
+    int len = 0;
+    while (buf64 < d->base64[len])
+      len++;
+    sym = static_cast<int>((buf64 - d->base64[len]) >> (64 - len - d->min_sym_len));
+    sym += read_le16(d->lowest_sym + 2 * len);
+    if (offset < d->symlen[sym] + 1)
+      break;
+    offset -= d->symlen[sym] + 1;
+    len += d->min_sym_len;
+    buf64 <<= len;
+    buf64_size -= len;
+    if (buf64_size <= 32) {
+      buf64_size += 32;
+      buf64 |= static_cast<uint64_t>(read_be32(ptr)) << (64 - buf64_size);
+      ptr += 4;
+    }
+  }
+
+  // Expand the pairs until reaching the single value at offset
+  while (d->symlen[sym]) {
+    const int left = btree_left(d, sym);
+    if (offset < d->symlen[left] + 1) {
+      sym = left;
+    } else {
+      offset -= d->symlen[left] + 1;
+      sym = btree_right(d, sym);
+    }
+  }
+  return btree_left(d, sym);
+}
+
+static uint64_t position_key(const BoardState& state)
+{
+  int counts[2][6];
+  for (int c = BLACK; c <= WHITE; c++) {
+    for (int piece = PAWN; piece <= KING; piece++)
+      counts[c][piece] = state.piece_count(static_cast<PieceColour>(c),
+        static_cast<Piece>(piece));
+  }
+  return tb_material_key(counts[WHITE], counts[BLACK]);
+}
+
+static int total_pieces(const BoardState& state)
+{
+  int total = 0;
+  for (int c = BLACK; c <= WHITE; c++) {
+    for (int piece = PAWN; piece <= KING; piece++)
+      total += state.piece_count(static_cast<PieceColour>(c), static_cast<Piece>(piece));
+  }
+  return total;
+}
+
+static int tb_piece_code(const Square& sq)
+{
+  return sq.occupancy + 1 + (sq.colour == BLACK ? 8 : 0);
+}
+
+static int map_dtz_score(TBTable& e, int f, int value, WDLScore wdl)
+{
+  static const int wdl_map[] = { 1, 3, 0, 2, 0 };
+  const PairsData* d = e.get(0, f);
+  if (d->flags & TB_FLAG_MAPPED) {
+    const int idx = d->map_idx[wdl_map[wdl + 2]] + value;
+    value = d->flags & TB_FLAG_WIDE ? read_le16(e.map + 2 * idx) : e.map[idx];
+  }
+  // Stored in moves unless flagged as plies; we always want plies
+  if ((wdl == WDL_WIN && !(d->flags & TB_FLAG_WIN_PLIES)) ||
+      (wdl == WDL_LOSS && !(d->flags & TB_FLAG_LOSS_PLIES)) ||
+      wdl == WDL_CURSED_WIN || wdl == WDL_BLESSED_LOSS)
+    value *= 2;
+  return value + 1;
+}
+
+static int probe_table(const BoardState& state, TBType type, WDLScore wdl,
+  ProbeState& result)
+{
+  if (total_pieces(state) == 2)
+    return WDL_DRAW;
+  const auto found = tb_by_key.find(position_key(state));
+  if (found == tb_by_key.end()) {
+    result = PROBE_FAIL;
+    return 0;
+  }
+  TBTable& e = type == TB_WDL ? *found->second.first : *found->second.second;
+  if (!table_mapped(e)) {
+    result = PROBE_FAIL;
+    return 0;
+  }
+
+  int squares[TB_PIECES];
+  int pieces[TB_PIECES];
+  int size = 0;
+  int lead_pawns_count = 0;
+  int tb_file = 0;
+  const bool black_to_move = !state.whites_turn;
+
+  // Tables are stored with white as the stronger side and, when both sides
+  // have the same material, only with white to move. Otherwise flip the
+  // colours and mirror the board vertically.
+  const bool symmetric_black_to_move = e.key == e.key2 && black_to_move;
+  const bool black_stronger = position_key(state) != e.key;
+  const int flip_colour = (symmetric_black_to_move || black_stronger) * 8;
+  const int flip_squares = (symmetric_black_to_move || black_stronger) * 56;
+  const int stm = (symmetric_black_to_move || black_stronger) ^ black_to_move;
+
+  // Pawn tables are split by the file of the leading pawn, mirrored to a-d
+  int lead_pawn_code = 0;
+  if (e.has_pawns) {
+    lead_pawn_code = e.get(0, 0)->pieces[0] ^ flip_colour;
+    for (int sq = 0; sq < 64; sq++) {
+      const Square& piece = state.board[sq / 8][sq % 8];
+      if (piece.occupancy != NONE && tb_piece_code(piece) == lead_pawn_code)
+        squares[size++] = sq ^ flip_squares;
+    }
+    lead_pawns_count = size;
+    swap(squares[0], *max_element(squares, squares + lead_pawns_count, pawns_comp));
+    tb_file = file_of(squares[0]);
+    if (tb_file > 3)
+      tb_file = file_of(squares[0] ^ 7);
+  }
+
+  if (type == TB_DTZ) {
+    const int flags = e.get(stm, tb_file)->flags;
+    if ((flags & TB_FLAG_STM) != stm && !(e.key == e.key2 && !e.has_pawns)) {
+      result = PROBE_CHANGE_STM;
+      return 0;
+    }
+  }
+
+  for (int sq = 0; sq < 64; sq++) {
+    const Square& piece = state.board[sq / 8][sq % 8];
+    if (piece.occupancy == NONE || tb_piece_code(piece) == lead_pawn_code)
+      continue;
+    squares[size] = sq ^ flip_squares;
+    pieces[size++] = tb_piece_code(piece) ^ flip_colour;
+  }
+
+  PairsData* d = e.get(stm, tb_file);
+
+  // Put the pieces in the order the table encodes them
+  for (int i = lead_pawns_count; i < size - 1; i++) {
+    for (int j = i + 1; j < size; j++) {
+      if (d->pieces[i] == pieces[j]) {
+        swap(pieces[i], pieces[j]);
+        swap(squares[i], squares[j]);
+        break;
+      }
+    }
+  }
+
+  // Mirror so the leading piece is on files a-d
+  if (file_of(squares[0]) > 3) {
+    for (int i = 0; i < size; i++)
+      squares[i] ^= 7;
+  }
+
+  uint64_t idx;
+  if (e.has_pawns) {
+    idx = lead_pawn_idx[lead_pawns_count][squares[0]];
+    stable_sort(squares + 1, squares + lead_pawns_count, pawns_comp);
+    for (int i = 1; i < lead_pawns_count; i++)
+      idx += binomial[i][map_pawns[squares[i]]];
+  } else {
+    // Without pawns also mirror onto ranks 1-4 and below the a1-h8 diagonal
+    if (rank_of(squares[0]) > 3) {
+      for (int i = 0; i < size; i++)
+        squares[i] ^= 56;
+    }
+    for (int i = 0; i < d->group_len[0]; i++) {
+      if (!off_a1h8(squares[i]))
+        continue;
+      if (off_a1h8(squares[i]) > 0) {
+        for (int j = i; j < size; j++)
+          squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+      }
+      break;
+    }
+
+    // The kings are encoded together, with a third piece if there's a
+    // piece type only one side has one of
+    if (e.has_unique_pieces) {
+      const int adjust1 = squares[1] > squares[0];
+      const int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+      if (off_a1h8(squares[0]))
+        idx = (map_a1d1d4[squares[0]] * 63 + (squares[1] - adjust1)) * 62 +
+          squares[2] - adjust2;
+      else if (off_a1h8(squares[1]))
+        idx = (6 * 63 + rank_of(squares[0]) * 28 + map_b1h1h7[squares[1]]) * 62 +
+          squares[2] - adjust2;
+      else if (off_a1h8(squares[2]))
+        idx = 6 * 63 * 62 + 4 * 28 * 62 + rank_of(squares[0]) * 7 * 28 +
+          (rank_of(squares[1]) - adjust1) * 28 + map_b1h1h7[squares[2]];
+      else
+        idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 +
+          rank_of(squares[0]) * 7 * 6 + (rank_of(squares[1]) - adjust1) * 6 +
+          (rank_of(squares[2]) - adjust2);
+    } else {
+      idx = map_kk[map_a1d1d4[squares[0]]][squares[1]];
+    }
+  }
+
+  // The remaining groups, each as a combination of its sorted squares
+  idx *= d->group_idx[0];
+  int* group_sq = squares + d->group_len[0];
+  bool remaining_pawns = e.has_pawns && e.pawn_count[1];
+  int next = 0;
+  while (d->group_len[++next]) {
+    stable_sort(group_sq, group_sq + d->group_len[next]);
+    uint64_t n = 0;
+    for (int i = 0; i < d->group_len[next]; i++) {
+      const int adjust = static_cast<int>(count_if(squares, group_sq,
+        [&](int sq) { return group_sq[i] > sq; }));
+      n += binomial[i + 1][group_sq[i] - adjust - 8 * remaining_pawns];
+    }
+    remaining_pawns = false;
+    idx += n * d->group_idx[next];
+    group_sq += d->group_len[next];
+  }
+
+  const int value = decompress_pairs(d, idx);
+  if (type == TB_WDL)
+    return value - 2;
+  return map_dtz_score(e, tb_file, value, wdl);
+}
+
+static bool is_capture(const BoardState& state, const Move& move)
+{
+  return state.board[move.to.y][move.to.x].occupancy != NONE ||
+    (state.board[move.from.y][move.from.x].occupancy == PAWN &&
+     move.from.x != move.to.x);
+}
+
+static bool is_zeroing(const BoardState& state, const Move& move)
+{
+  return is_capture(state, move) ||
+    state.board[move.from.y][move.from.x].occupancy == PAWN;
+}
+
+static PieceColour side_to_move(const BoardState& state)
+{
+  return state.whites_turn ? WHITE : BLACK;
+}
+
+// Whether any move apart from those skip() accepts is legal
+template <typename Skip>
+static bool has_legal_move(BoardState& state, Skip skip)
+{
+  state.EnumerateMoves();
+  for (const Move& move : state.possible_moves) {
+    if (skip(move))
+      continue;
+    BoardState child(&state, &move, false);
+    if (!child.in_check(side_to_move(state)))
+      return true;
+  }
+  return false;
+}
+
+// Tables store "don't care" values where a capture (or, for DTZ, a pawn
+// move) is best, so those moves must be searched and their best result
+// combined with the stored one
+static WDLScore search(BoardState& state, ProbeState& result, bool check_zeroing_moves)
+{
+  WDLScore best_value = WDL_LOSS;
+  int move_count = 0;
+  state.EnumerateMoves();
+  for (const Move& move : state.possible_moves) {
+    if (!is_capture(state, move) &&
+        (!check_zeroing_moves || state.board[move.from.y][move.from.x].occupancy != PAWN))
+      continue;
+    BoardState child(&state, &move, true);
+    if (child.in_check(side_to_move(state)))
+      continue;
+    move_count++;
+    const WDLScore value = static_cast<WDLScore>(-search(child, result, false));
+    if (result == PROBE_FAIL)
+      return WDL_DRAW;
+    if (value > best_value) {
+      best_value = value;
+      if (value >= WDL_WIN) {
+        result = PROBE_ZEROING_BEST_MOVE;
+        return value;
+      }
+    }
+  }
+
+  // If every legal move was searched the stored value isn't needed, and may
+  // be wrong, e.g. when en passant is possible
+  const bool no_more_moves = move_count && !has_legal_move(state,
+    [&](const Move& move) {
+      return is_capture(state, move) || (check_zeroing_moves &&
+        state.board[move.from.y][move.from.x].occupancy == PAWN);
+    });
+  WDLScore value;
+  if (no_more_moves) {
+    value = best_value;
+  } else {
+    value = static_cast<WDLScore>(probe_table(state, TB_WDL, WDL_DRAW, result));
+    if (result == PROBE_FAIL)
+      return WDL_DRAW;
+  }
+
+  if (best_value >= value) {
+    result = best_value > WDL_DRAW || no_more_moves ? PROBE_ZEROING_BEST_MOVE : PROBE_OK;
+    return best_value;
+  }
+  result = PROBE_OK;
+  return value;
+}
+
+static int dtz_before_zeroing(WDLScore wdl)
+{
+  return wdl == WDL_WIN ? 1
+    : wdl == WDL_CURSED_WIN ? 101
+    : wdl == WDL_BLESSED_LOSS ? -101
+    : wdl == WDL_LOSS ? -1 : 0;
+}
+
+static int sign_of(int value)
+{
+  return (value > 0) - (value < 0);
+}
+
+// Plies to the next capture or pawn move in the best line, signed by the
+// result for the side to move; 0 for a draw
+static int probe_dtz(BoardState& state, ProbeState& result)
+{
+  result = PROBE_OK;
+  const WDLScore wdl = search(state, result, true);
+  if (result == PROBE_FAIL || wdl == WDL_DRAW)
+    return 0;
+  if (result == PROBE_ZEROING_BEST_MOVE)
+    return dtz_before_zeroing(wdl);
+
+  int dtz = probe_table(state, TB_DTZ, wdl, result);
+  if (result == PROBE_FAIL)
+    return 0;
+  if (result != PROBE_CHANGE_STM)
+    return (dtz + 100 * (wdl == WDL_BLESSED_LOSS || wdl == WDL_CURSED_WIN)) * sign_of(wdl);
+
+  // Only stored for the other side to move, so search one ply
+  int min_dtz = 0xFFFF;
+  for (const Move& move : state.possible_moves) {
+    const bool zeroing = is_zeroing(state, move);
+    BoardState child(&state, &move, true);
+    if (child.in_check(side_to_move(state)))
+      continue;
+    dtz = zeroing ? -dtz_before_zeroing(search(child, result, false))
+      : -probe_dtz(child, result);
+    if (dtz == 1 && child.in_check(side_to_move(child)) &&
+        !has_legal_move(child, [](const Move&) { return false; }))
+      min_dtz = 1;
+    if (!zeroing)
+      dtz += sign_of(dtz);
+    if (dtz < min_dtz && sign_of(dtz) == sign_of(wdl))
+      min_dtz = dtz;
+    if (result == PROBE_FAIL)
+      return 0;
+  }
+  return min_dtz == 0xFFFF ? -1 : min_dtz;
+}
+
+static bool probe_allowed(const BoardState& state)
+{
+  return tb_max_pieces && !state.any_castling_rights() &&
+    total_pieces(state) <= tb_max_pieces;
+}
+
+bool syzygy_probe_wdl(BoardState& state, WDLScore& wdl)
+{
+  if (!probe_allowed(state))
+    return false;
+  ProbeState result = PROBE_OK;
+  wdl = search(state, result, false);
+  return result != PROBE_FAIL;
+}
+
+bool syzygy_probe_dtz(BoardState& state, int& dtz)
+{
+  if (!probe_allowed(state))
+    return false;
+  ProbeState result;
+  dtz = probe_dtz(state, result);
+  return result != PROBE_FAIL;
+}
+
+bool syzygy_probe_root(BoardState& state, const Move*& best_move, WDLScore& wdl)
+{
+  if (!probe_allowed(state))
+    return false;
+  ProbeState result = PROBE_OK;
+  int best_rank = INT_MIN;
+  int best_dtz = 0;
+  best_move = nullptr;
+  state.EnumerateMoves();
+  for (const Move& move : state.possible_moves) {
+    const bool zeroing = is_zeroing(state, move);
+    BoardState child(&state, &move, true);
+    if (child.in_check(side_to_move(state)))
+      continue;
+    int dtz;
+    if (zeroing) {
+      dtz = dtz_before_zeroing(static_cast<WDLScore>(-search(child, result, false)));
+    } else {
+      dtz = -probe_dtz(child, result);
+      dtz = dtz > 0 ? dtz + 1 : dtz < 0 ? dtz - 1 : dtz;
+    }
+    // A mating move always ranks first
+    if (dtz == 2 && child.in_check(side_to_move(child)) &&
+        !has_legal_move(child, [](const Move&) { return false; }))
+      dtz = 1;
+    if (result == PROBE_FAIL)
+      return false;
+
+    // Win as fast as possible, lose as slowly as possible
+    const int rank = dtz > 0 ? 10000 - dtz : dtz < 0 ? -10000 - dtz : 0;
+    if (rank > best_rank) {
+      best_rank = rank;
+      best_dtz = dtz;
+      best_move = &move;
+    }
+  }
+  if (!best_move)
+    return false;
+  wdl = best_dtz > 100 ? WDL_CURSED_WIN
+    : best_dtz > 0 ? WDL_WIN
+    : best_dtz < -100 ? WDL_BLESSED_LOSS
+    : best_dtz < 0 ? WDL_LOSS : WDL_DRAW;
+  return true;
+}
+
+static bool file_exists(const string& name)
+{
+  for (const string& dir : tb_paths) {
+    if (ifstream(dir + "/" + name).is_open())
+      return true;
+  }
+  return false;
+}
+
+static void add_table(const vector<Piece>& pieces)
+{
+  static const string piece_letters = "PNBRQK";
+  string code;
+  for (Piece piece : pieces)
+    code += piece_letters[piece];
+  code.insert(code.find('K', 1), "v");
+  if (!file_exists(code + ".rtbw"))
+    return;
+
+  tb_tables.emplace_back(new TBTable(code, TB_WDL));
+  TBTable* wdl = tb_tables.back().get();
+  tb_tables.emplace_back(new TBTable(code, TB_DTZ));
+  TBTable* dtz = tb_tables.back().get();
+  tb_by_key[wdl->key] = make_pair(wdl, dtz);
+  tb_by_key[wdl->key2] = make_pair(wdl, dtz);
+  tb_max_pieces = max(tb_max_pieces, wdl->piece_count);
+}
+
+void syzygy_init(const string& path)
+{
+  static bool index_tables_ready = false;
+  if (!index_tables_ready) {
+    init_index_tables();
+    index_tables_ready = true;
+  }
+
+  tb_by_key.clear();
+  tb_tables.clear();
+  tb_paths.clear();
+  tb_max_pieces = 0;
+
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find(path_separator, start);
+    if (end == string::npos)
+      end = path.size();
+    if (end > start)
+      tb_paths.push_back(path.substr(start, end - start));
+    start = end + 1;
+  }
+  if (tb_paths.empty())
+    return;
+
+  // Every table of up to seven pieces, strongest pieces listed first
+  for (int p1 = PAWN; p1 < KING; p1++) {
+    const Piece a = static_cast<Piece>(p1);
+    add_table({ KING, a, KING });
+    for (int p2 = PAWN; p2 <= p1; p2++) {
+      const Piece b = static_cast<Piece>(p2);
+      add_table({ KING, a, b, KING });
+      add_table({ KING, a, KING, b });
+      for (int p3 = PAWN; p3 < KING; p3++)
+        add_table({ KING, a, b, KING, static_cast<Piece>(p3) });
+      for (int p3 = PAWN; p3 <= p2; p3++) {
+        const Piece c = static_cast<Piece>(p3);
+        add_table({ KING, a, b, c, KING });
+        for (int p4 = PAWN; p4 <= p3; p4++) {
+          const Piece d = static_cast<Piece>(p4);
+          add_table({ KING, a, b, c, d, KING });
+          for (int p5 = PAWN; p5 <= p4; p5++)
+            add_table({ KING, a, b, c, d, static_cast<Piece>(p5), KING });
+          for (int p5 = PAWN; p5 < KING; p5++)
+            add_table({ KING, a, b, c, d, KING, static_cast<Piece>(p5) });
+        }
+        for (int p4 = PAWN; p4 < KING; p4++) {
+          const Piece d = static_cast<Piece>(p4);
+          add_table({ KING, a, b, c, KING, d });
+          for (int p5 = PAWN; p5 <= p4; p5++)
+            add_table({ KING, a, b, c, KING, d, static_cast<Piece>(p5) });
+        }
+      }
+      for (int p3 = PAWN; p3 <= p1; p3++) {
+        for (int p4 = PAWN; p4 <= (p1 == p3 ? p2 : p3); p4++)
+          add_table({ KING, a, b, KING, static_cast<Piece>(p3), static_cast<Piece>(p4) });
+      }
+    }
+  }
+}
+
+int syzygy_max_pieces()
+{
+  return tb_max_pieces;
+}
+
+vector<string> syzygy_tables()
+{
+  vector<string> codes;
+  for (const auto& table : tb_tables) {
+    if (table->type == TB_WDL)
+      codes.push_back(table->code);
+  }
+  return codes;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Chess.h"
+
+using namespace std;
+
+enum WDLScore {
+  WDL_LOSS = -2,
+  WDL_BLESSED_LOSS = -1, // Loss, but drawn by the 50-move rule
+  WDL_DRAW = 0,
+  WDL_CURSED_WIN = 1,    // Win, but drawn by the 50-move rule
+  WDL_WIN = 2,
+};
+
+// Registers the tables found in path, a list of directories separated by
+// ';' on Windows and ':' elsewhere. Files are only mapped when first probed.
+void syzygy_init(const string& path);
+
+// Number of pieces, kings included, in the largest table found, or 0
+int syzygy_max_pieces();
+
+// The tables found, named as their files are, e.g. KRPvKR
+vector<string> syzygy_tables();
+
+// Win/draw/loss for the side to move. Fails if the table is missing or the
+// position still has castling rights, which the tables don't cover.
+bool syzygy_probe_wdl(BoardState& state, WDLScore& wdl);
+
+// Plies to the next capture or pawn move with best play, positive when the
+// side to move wins, negative when it loses and 0 for a draw. As stored in
+// the tables, a win or loss of n plies may really take n + 1.
+bool syzygy_probe_dtz(BoardState& state, int& dtz);
+
+// Picks the root move that best preserves the tablebase result, winning
+// moves ranked by the fewest plies until a capture or pawn move
+bool syzygy_probe_root(BoardState& state, const Move*& best_move, WDLScore& wdl);
@@ -0,0 +1,502 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Syzygy.h"
+#include "SyzygyCheck.h"
+
+enum Outcome : int8_t {
+  OUTCOME_INVALID, // Not a legal position with this side to move
+  OUTCOME_UNKNOWN,
+  OUTCOME_WON,     // For the side to move
+  OUTCOME_LOST,
+  OUTCOME_DRAWN,
+};
+
+class Ending {
+public:
+  const char* name;
+  Piece piece;
+  PieceColour colour;
+};
+
+// Solved in this order, so a promotion always leads into a solved ending
+static const Ending endings[] = {
+  { "KQvK", QUEEN, WHITE },
+  { "KvKQ", QUEEN, BLACK },
+  { "KRvK", ROOK, WHITE },
+  { "KvKR", ROOK, BLACK },
+  { "KPvK", PAWN, WHITE },
+  { "KvKP", PAWN, BLACK },
+};
+constexpr int num_endings = sizeof(endings) / sizeof(endings[0]);
+
+// Positions are indexed by the side to move and the squares of the white
+// king, black king and the third piece
+constexpr int positions_per_ending = 2 * 64 * 64 * 64;
+
+// Moves out of an ending, as seen by the side making them, are stored with
+// their result; moves within it as the index they lead to
+constexpr int32_t target_won = -1;  // Promotion to a lost position
+constexpr int32_t target_lost = -2; // Promotion to a won position
+constexpr int32_t target_drawn = -3; // Capture of the piece, or promotion
+constexpr int32_t target_zeroing = 1 << 30; // Flags a pawn move
+
+constexpr uint8_t plies_unknown = 255;
+// Mismatched positions printed for each ending and kind of check
+constexpr int max_reports = 5;
+// Only every so many positions has its root move checked, which is slow
+constexpr int root_check_stride = 64;
+
+class EndingSolution {
+public:
+  vector<Outcome> outcomes;
+  // Plies to the next capture, pawn move or mate with best play
+  vector<uint8_t> plies;
+};
+
+static int position_index(bool black_to_move, int white_king, int black_king, int piece)
+{
+  return ((black_to_move * 64 + white_king) * 64 + black_king) * 64 + piece;
+}
+
+// The piece placement field of a FEN, from the letter on each square or 0
+static string placement_fen(const char squares[64])
+{
+  string fen;
+  for (int y = 7; y >= 0; y--) {
+    int empty = 0;
+    for (int x = 0; x < 8; x++) {
+      const char c = squares[y * 8 + x];
+      if (!c) {
+        empty++;
+        continue;
+      }
+      if (empty)
+        fen += char('0' + empty);
+      empty = 0;
+      fen += c;
+    }
+    if (empty)
+      fen += char('0' + empty);
+    if (y)
+      fen += '/';
+  }
+  return fen;
+}
+
+static string position_fen(const Ending& ending, int index)
+{
+  const int piece = index % 64;
+  const int black_king = index / 64 % 64;
+  const int white_king = index / (64 * 64) % 64;
+  const bool black_to_move = index / (64 * 64 * 64) != 0;
+
+  char squares[64];
+  fill(begin(squares), end(squares), 0);
+  squares[white_king] = 'K';
+  squares[black_king] = 'k';
+  squares[piece] = "pnbrqk"[ending.piece] - (ending.colour == WHITE ? 'a' - 'A' : 0);
+  return placement_fen(squares) + (black_to_move ? " b - - 0 1" : " w - - 0 1");
+}
+
+// Sets up the position at index, or fails if it isn't legal
+static bool load_position(const Ending& ending, int index, BoardState& state)
+{
+  const int piece = index % 64;
+  const int black_king = index / 64 % 64;
+  const int white_king = index / (64 * 64) % 64;
+  if (piece == white_king || piece == black_king || white_king == black_king)
+    return false;
+  if (ending.piece == PAWN && (piece < 8 || piece >= 56))
+    return false;
+  return state.load_fen(position_fen(ending, index));
+}
+
+static Outcome opposite(Outcome outcome)
+{
+  return outcome == OUTCOME_WON ? OUTCOME_LOST
+    : outcome == OUTCOME_LOST ? OUTCOME_WON : outcome;
+}
+
+// Where a legal move from an ending leads, with promotions looked up in the
+// solved ending for the queen
+static int32_t move_target(const BoardState& state, const Move& move,
+  const BoardState& child, const vector<EndingSolution>& solved)
+{
+  int kings[2] = { -1, -1 };
+  int piece = -1;
+  Piece kind = NONE;
+  PieceColour colour = WHITE;
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      const Square& sq = child.board[y][x];
+      if (sq.occupancy == KING) {
+        kings[sq.colour] = y * 8 + x;
+      } else if (sq.occupancy != NONE) {
+        piece = y * 8 + x;
+        kind = sq.occupancy;
+        colour = sq.colour;
+      }
+    }
+  }
+  if (piece < 0)
+    return target_drawn;
+
+  const int index = position_index(state.whites_turn, kings[WHITE], kings[BLACK], piece);
+  if (kind == QUEEN && state.board[move.from.y][move.from.x].occupancy == PAWN) {
+    const int queen_ending = colour == WHITE ? 0 : 1;
+    switch (solved[queen_ending].outcomes[index]) {
+    case OUTCOME_WON:
+      return target_lost;
+    case OUTCOME_LOST:
+      return target_won;
+    default:
+      return target_drawn;
+    }
+  }
+  return state.board[move.from.y][move.from.x].occupancy == PAWN ?
+    index | target_zeroing : index;
+}
+
+// The result of a move for the side making it, if known yet
+static Outcome move_outcome(const EndingSolution& solution, int32_t target)
+{
+  if (target == target_won)
+    return OUTCOME_WON;
+  if (target == target_lost)
+    return OUTCOME_LOST;
+  if (target == target_drawn)
+    return OUTCOME_DRAWN;
+  return opposite(solution.outcomes[target & ~target_zeroing]);
+}
+
+// Plies to the next capture, pawn move or mate after a move, or
+// plies_unknown if that isn't solved yet
+static int move_plies(const EndingSolution& solution, int32_t target)
+{
+  if (target < 0 || (target & target_zeroing))
+    return 1;
+  const uint8_t plies = solution.plies[target];
+  return plies == plies_unknown ? plies_unknown : plies + 1;
+}
+
+static EndingSolution solve_ending(const Ending& ending, const vector<EndingSolution>& solved)
+{
+  EndingSolution solution;
+  solution.outcomes.assign(positions_per_ending, OUTCOME_INVALID);
+  solution.plies.assign(positions_per_ending, plies_unknown);
+  vector<uint32_t> first_target(positions_per_ending + 1, 0);
+  vector<int32_t> targets;
+
+  BoardState state;
+  for (int index = 0; index < positions_per_ending; index++) {
+    first_target[index] = static_cast<uint32_t>(targets.size());
+    if (!load_position(ending, index, state))
+      continue;
+    const PieceColour us = state.whites_turn ? WHITE : BLACK;
+    for (const Move& move : state.possible_moves) {
+      BoardState child(&state, &move, false);
+      if (!child.in_check(us))
+        targets.push_back(move_target(state, move, child, solved));
+    }
+    if (targets.size() > first_target[index]) {
+      solution.outcomes[index] = OUTCOME_UNKNOWN;
+    } else if (state.in_check(us)) {
+      solution.outcomes[index] = OUTCOME_LOST;
+      solution.plies[index] = 0;
+    } else {
+      solution.outcomes[index] = OUTCOME_DRAWN;
+    }
+  }
+  first_target[positions_per_ending] = static_cast<uint32_t>(targets.size());
+
+  // A position is won if any move wins and lost if every move loses.
+  // Whatever is left once nothing changes is drawn.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int index = 0; index < positions_per_ending; index++) {
+      if (solution.outcomes[index] != OUTCOME_UNKNOWN)
+        continue;
+      bool all_lose = true;
+      for (uint32_t t = first_target[index]; t < first_target[index + 1]; t++) {
+        const Outcome outcome = move_outcome(solution, targets[t]);
+        if (outcome == OUTCOME_WON) {
+          solution.outcomes[index] = OUTCOME_WON;
+          break;
+        }
+        if (outcome != OUTCOME_LOST)
+          all_lose = false;
+      }
+      if (solution.outcomes[index] == OUTCOME_UNKNOWN && all_lose)
+        solution.outcomes[index] = OUTCOME_LOST;
+      changed |= solution.outcomes[index] != OUTCOME_UNKNOWN;
+    }
+  }
+  for (Outcome& outcome : solution.outcomes) {
+    if (outcome == OUTCOME_UNKNOWN)
+      outcome = OUTCOME_DRAWN;
+  }
+
+  // The winner heads for the nearest capture, pawn move or mate that keeps
+  // the win, the loser for the furthest, one ply further each pass
+  for (int plies = 1; plies < plies_unknown; plies++) {
+    bool unsolved = false;
+    for (int index = 0; index < positions_per_ending; index++) {
+      const Outcome outcome = solution.outcomes[index];
+      if ((outcome != OUTCOME_WON && outcome != OUTCOME_LOST) ||
+          solution.plies[index] != plies_unknown)
+        continue;
+      int best = outcome == OUTCOME_WON ? plies_unknown : 0;
+      for (uint32_t t = first_target[index]; t < first_target[index + 1]; t++) {
+        if (move_outcome(solution, targets[t]) != outcome)
+          continue;
+        const int move = move_plies(solution, targets[t]);
+        best = outcome == OUTCOME_WON ? min(best, move) : max(best, move);
+      }
+      if (best == plies)
+        solution.plies[index] = static_cast<uint8_t>(plies);
+      else
+        unsolved = true;
+    }
+    if (!unsolved)
+      break;
+  }
+  return solution;
+}
+
+static WDLScore outcome_wdl(Outcome outcome)
+{
+  return outcome == OUTCOME_WON ? WDL_WIN
+    : outcome == OUTCOME_LOST ? WDL_LOSS : WDL_DRAW;
+}
+
+// Compares every position of an ending with the tables, returning the
+// number that differ
+static int check_ending(const Ending& ending, const vector<EndingSolution>& solved,
+  const EndingSolution& solution)
+{
+  int positions = 0, wdl_errors = 0, dtz_errors = 0, root_errors = 0;
+  BoardState state;
+  for (int index = 0; index < positions_per_ending; index++) {
+    const Outcome outcome = solution.outcomes[index];
+    if (outcome == OUTCOME_INVALID || !load_position(ending, index, state))
+      continue;
+    positions++;
+    const string fen = position_fen(ending, index);
+
+    // A mated or stalemated position has nothing left to look up
+    const bool has_moves = outcome == OUTCOME_DRAWN || solution.plies[index] > 0;
+    WDLScore wdl;
+    if (!syzygy_probe_wdl(state, wdl) || wdl != outcome_wdl(outcome)) {
+      if (++wdl_errors <= max_reports)
+        cout << "WDL differs in " << fen << "\n";
+      continue;
+    }
+
+    // Stored DTZ may be a ply short of the truth
+    int dtz;
+    const int plies = solution.plies[index];
+    bool dtz_ok = syzygy_probe_dtz(state, dtz);
+    if (outcome == OUTCOME_DRAWN)
+      dtz_ok = dtz_ok && dtz == 0;
+    else
+      dtz_ok = dtz_ok && dtz != 0 && (dtz > 0) == (outcome == OUTCOME_WON) &&
+        (abs(dtz) == plies || abs(dtz) == plies - 1);
+    if (has_moves && !dtz_ok) {
+      if (++dtz_errors <= max_reports)
+        cout << "DTZ " << dtz << " where " << plies << " plies expected in " << fen << "\n";
+      continue;
+    }
+
+    // Each move's DTZ may be a ply short too, so the move picked may take
+    // a ply longer to win, or lose a ply sooner, than the best
+    if (!has_moves || index % root_check_stride != 0)
+      continue;
+    const Move* move;
+    bool root_ok = syzygy_probe_root(state, move, wdl) && wdl == outcome_wdl(outcome);
+    if (root_ok) {
+      BoardState child(&state, move, false);
+      const int32_t target = move_target(state, *move, child, solved);
+      const int move_result = move_plies(solution, target);
+      root_ok = move_outcome(solution, target) == outcome &&
+        (outcome != OUTCOME_WON || move_result <= plies + 1) &&
+        (outcome != OUTCOME_LOST || move_result >= plies - 1);
+    }
+    if (!root_ok && ++root_errors <= max_reports)
+      cout << "Root move differs in " << fen << "\n";
+  }
+
+  cout << ending.name << ": " << positions << " positions, " << wdl_errors <<
+    " WDL, " << dtz_errors << " DTZ and " << root_errors <<
+    " root move differences\n";
+  return wdl_errors + dtz_errors + root_errors;
+}
+
+int run_syzygy_check()
+{
+  if (syzygy_max_pieces() < 3) {
+    cout << "No tablebases to check; set SyzygyPath first\n";
+    return 1;
+  }
+
+  int differences = 0;
+  vector<EndingSolution> solved;
+  for (int i = 0; i < num_endings; i++) {
+    solved.push_back(solve_ending(endings[i], solved));
+
+    // Any legal position will do to see whether the table is there
+    BoardState state;
+    WDLScore wdl;
+    const int sample = position_index(false, 4, 60, endings[i].piece == PAWN ? 12 : 3);
+    if (!load_position(endings[i], sample, state) || !syzygy_probe_wdl(state, wdl)) {
+      cout << endings[i].name << ": table not found\n";
+      differences++;
+      continue;
+    }
+    differences += check_ending(endings[i], solved, solved.back());
+  }
+  return differences ? 1 : 0;
+}
+
+// A random placement of the pieces of a table, which may not be legal
+static string random_fen(const string& code, mt19937& rng)
+{
+  char squares[64];
+  fill(begin(squares), end(squares), 0);
+  bool white = true;
+  for (char c : code) {
+    if (c == 'v') {
+      white = false;
+      continue;
+    }
+    // Pawns never stand on the first or last rank
+    uniform_int_distribution<int> square(c == 'P' ? 8 : 0, c == 'P' ? 55 : 63);
+    int sq;
+    do {
+      sq = square(rng);
+    } while (squares[sq]);
+    squares[sq] = white ? c : static_cast<char>(tolower(c));
+  }
+  const bool black_to_move = rng() & 1;
+  return placement_fen(squares) + (black_to_move ? " b - - 0 1" : " w - - 0 1");
+}
+
+// Wins and losses, whether or not the fifty-move rule spoils them, as any
+// capture or pawn move resets the count
+static int wdl_sign(WDLScore wdl)
+{
+  return (wdl > WDL_DRAW) - (wdl < WDL_DRAW);
+}
+
+enum Consistency {
+  CONSISTENT,
+  INCONSISTENT,
+  UNCHECKED, // A table the moves lead to is missing, or an underpromotion may matter
+};
+
+// Whether the WDL and DTZ probed for a position agree with those of its
+// moves. The best move's result must be the position's. A winning move
+// must get closer to the next capture or pawn move, and no losing move put
+// it further off, give or take the ply lost where DTZ is stored in moves.
+static Consistency check_position(BoardState& state, string& problem)
+{
+  WDLScore wdl;
+  int dtz;
+  if (!syzygy_probe_wdl(state, wdl) || !syzygy_probe_dtz(state, dtz)) {
+    problem = "can't be probed";
+    return INCONSISTENT;
+  }
+
+  const PieceColour us = state.whites_turn ? WHITE : BLACK;
+  int best = -2;
+  bool promotions = false;
+  bool dtz_reached = false;
+  int slowest_loss = 0;
+  int moves = 0;
+  for (const Move& move : state.possible_moves) {
+    BoardState child(&state, &move, true);
+    if (child.in_check(us))
+      continue;
+    moves++;
+    const Piece moving = state.board[move.from.y][move.from.x].occupancy;
+    const bool zeroing = moving == PAWN ||
+      state.board[move.to.y][move.to.x].occupancy != NONE;
+    promotions |= moving == PAWN && (move.to.y == 0 || move.to.y == 7);
+    WDLScore child_wdl;
+    int child_dtz;
+    if (!syzygy_probe_wdl(child, child_wdl) ||
+        (!zeroing && !syzygy_probe_dtz(child, child_dtz)))
+      return UNCHECKED;
+    const int value = -wdl_sign(child_wdl);
+    best = max(best, value);
+    if (zeroing)
+      dtz_reached |= value > 0;
+    else if (value > 0)
+      dtz_reached |= abs(child_dtz) <= abs(dtz) + 1;
+    else if (value < 0)
+      slowest_loss = max(slowest_loss, abs(child_dtz));
+  }
+
+  if (!moves) {
+    const int expected = state.in_check(us) ? -1 : 0;
+    if (wdl_sign(wdl) == expected)
+      return CONSISTENT;
+    problem = "has no moves but isn't scored as mate or stalemate";
+    return INCONSISTENT;
+  }
+  // Only queen promotions are generated, so an underpromotion could be
+  // what the table rightly sees
+  if (wdl_sign(wdl) > best && promotions)
+    return UNCHECKED;
+  if (wdl_sign(wdl) != best) {
+    problem = "doesn't score as its best move does";
+    return INCONSISTENT;
+  }
+  if ((dtz > 0) - (dtz < 0) != best) {
+    problem = "has DTZ " + to_string(dtz) + " of the wrong sign";
+    return INCONSISTENT;
+  }
+  if (best > 0 && !dtz_reached) {
+    problem = "has DTZ " + to_string(dtz) + " but no winning move gets closer";
+    return INCONSISTENT;
+  }
+  if (best < 0 && slowest_loss > abs(dtz) + 1) {
+    problem = "has DTZ " + to_string(dtz) + " but a move loses more slowly";
+    return INCONSISTENT;
+  }
+  return CONSISTENT;
+}
+
+int verify_syzygy_tables(int samples_per_table)
+{
+  // Seeded the same every time, so a failure can be reproduced
+  mt19937 rng(0);
+  int failures = 0;
+  BoardState state;
+  for (const string& code : syzygy_tables()) {
+    int checked = 0;
+    // Most random placements are legal, so this many tries seldom run out
+    for (int tries = 0; checked < samples_per_table && tries < 50 * samples_per_table; tries++) {
+      const string fen = random_fen(code, rng);
+      if (!state.load_fen(fen))
+        continue;
+      string problem;
+      const Consistency result = check_position(state, problem);
+      if (result == UNCHECKED)
+        continue;
+      if (result == INCONSISTENT) {
+        cout << code << " reads wrongly: " << fen << " " << problem << "\n";
+        failures++;
+        break;
+      }
+      checked++;
+    }
+  }
+  return failures;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// Checks the tables registered with SyzygyPath= against the engine's own
+// solution of KQvK, KRvK and KPvK, with either colour to move and either
+// colour holding the piece. Each ending is solved by retrograde analysis
+// with the engine's move generator. Then every position is probed for its
+// WDL and DTZ, and some for their root move, and the results are compared.
+//
+// Promotions are always to a queen here, as in the rest of the engine, so
+// a KPvK position that only an underpromotion wins would be reported too.
+// Returns 0 if every table was found and matched.
+int run_syzygy_check();
+
+// Probes a few random positions of every table registered and checks that
+// each position's WDL and DTZ agree with those of its moves. A file that is
+// corrupt, or that the decoder misreads, seldom survives this, though it
+// can't catch a table that is wrong in a consistent way. Returns the number
+// of tables that failed, after printing a position from each.
+int verify_syzygy_tables(int samples_per_table);
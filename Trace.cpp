@@ -0,0 +1,115 @@
+#ifdef CHESS_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+#include "Trace.h"
+
+class TraceEvent {
+public:
+  const char* name;
+  const char* key;
+  string value;
+  int64_t start;
+  int64_t duration;
+  int thread;
+};
+
+static atomic<bool> tracing(false);
+static string trace_path;
+static mutex events_mutex;
+static vector<TraceEvent> events;
+static atomic<int> next_thread_id(0);
+static const chrono::steady_clock::time_point trace_epoch = chrono::steady_clock::now();
+
+static int64_t now_us()
+{
+  return chrono::duration_cast<chrono::microseconds>(
+    chrono::steady_clock::now() - trace_epoch).count();
+}
+
+// Small sequential ids read better in the viewer than hashed thread ids
+static int thread_id()
+{
+  static thread_local int id = next_thread_id++;
+  return id;
+}
+
+static void write_json_string(ostream& out, const string& str)
+{
+  out << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\')
+      out << '\\';
+    out << c;
+  }
+  out << '"';
+}
+
+static void trace_close()
+{
+  tracing = false;
+  lock_guard<mutex> lock(events_mutex);
+  ofstream out(trace_path);
+  out << "{\"traceEvents\":[\n";
+  for (size_t i = 0; i < events.size(); i++) {
+    const TraceEvent& e = events[i];
+    out << (i ? ",\n" : "") << "{\"name\":";
+    write_json_string(out, e.name);
+    out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread <<
+      ",\"ts\":" << e.start << ",\"dur\":" << e.duration;
+    if (e.key) {
+      out << ",\"args\":{";
+      write_json_string(out, e.key);
+      out << ":";
+      write_json_string(out, e.value);
+      out << "}";
+    }
+    out << "}";
+  }
+  out << "\n]}\n";
+}
+
+bool trace_open(const string& path)
+{
+  if (!ofstream(path))
+    return false;
+  lock_guard<mutex> lock(events_mutex);
+  if (trace_path.empty())
+    atexit(trace_close);
+  trace_path = path;
+  events.clear();
+  tracing = true;
+  return true;
+}
+
+bool trace_sample(unsigned& counter, unsigned rate)
+{
+  return tracing && counter++ % rate == 0;
+}
+
+TraceSpan::TraceSpan(const char* span_name, const char* arg_key, const string& arg_value)
+  : name(span_name)
+  , key(arg_key)
+  , value(arg_value)
+  , start(0)
+  , active(span_name && tracing)
+{
+  if (active)
+    start = now_us();
+}
+
+TraceSpan::~TraceSpan()
+{
+  if (!active || !tracing)
+    return;
+  const int64_t end = now_us();
+  lock_guard<mutex> lock(events_mutex);
+  events.push_back(TraceEvent{ name, key, value, start, end - start, thread_id() });
+}
+
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+using namespace std;
+
+// Chrome Trace Event output, viewable in chrome://tracing or Perfetto.
+// Everything here compiles to nothing unless CHESS_TRACE is defined, so
+// the spans can stay in hot code.
+//
+//   TRACE_SCOPE("name")                 span covering the enclosing scope
+//   TRACE_SCOPE_ARG("name", "key", str) span with one string argument
+//   TRACE_SAMPLED_SCOPE("name", n)      span for one in every n executions
+
+#ifdef CHESS_TRACE
+
+#include <cstdint>
+
+// Starts recording. Events are written to path when the program exits.
+bool trace_open(const string& path);
+
+class TraceSpan {
+public:
+  TraceSpan(const char* span_name, const char* arg_key = nullptr, const string& arg_value = "");
+  ~TraceSpan();
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+private:
+  const char* name;
+  const char* key;
+  string value;
+  int64_t start;
+  bool active;
+};
+
+// Chooses which executions of a sampled span are recorded
+bool trace_sample(unsigned& counter, unsigned rate);
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, key, value) \
+  TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name, key, value)
+#define TRACE_SAMPLED_SCOPE(name, rate) \
+  static thread_local unsigned TRACE_CONCAT(trace_counter_, __LINE__) = 0; \
+  TraceSpan TRACE_CONCAT(trace_span_, __LINE__)( \
+    trace_sample(TRACE_CONCAT(trace_counter_, __LINE__), rate) ? name : nullptr)
+
+#else
+
+inline bool trace_open(const string&)
+{
+  return false;
+}
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, key, value)
+#define TRACE_SAMPLED_SCOPE(name, rate)
+
+#endif
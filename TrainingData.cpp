@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cstring>
+
+#include "Attacks.h"
+#include "TrainingData.h"
+#include "Zobrist.h"
+
+void pack_position(const BoardState& state, int score, int ply, bool capture,
+  PackedPosition& packed)
+{
+  memset(&packed, 0, sizeof(packed));
+  int num_pieces = 0;
+  for (int square = 0; square < 64; square++) {
+    const Square& sq = state.board[square / 8][square % 8];
+    if (sq.occupancy == NONE)
+      continue;
+    const int piece_type = !sq.colour * 6 + sq.occupancy;
+    packed.occupied |= 1ULL << square;
+    packed.pieces[num_pieces / 2] |= piece_type << (num_pieces % 2 * 4);
+    num_pieces++;
+  }
+  packed.score = static_cast<int16_t>(max(INT16_MIN + 1, min(INT16_MAX - 1, score)));
+  packed.result = RESULT_UNKNOWN;
+  packed.flags = (state.whites_turn ? PACKED_WHITES_TURN : 0) |
+    (state.in_endgame() ? PACKED_ENDGAME : 0) | (capture ? PACKED_CAPTURE : 0);
+  for (int right = 0; right < 4; right++) {
+    if (state.has_castling_right(right))
+      packed.flags |= PACKED_CASTLING << right;
+  }
+  const Coords& en_passant = state.en_passant_square();
+  if (en_passant.x >= 0 && en_passant.x < 8 && en_passant.y >= 0)
+    packed.en_passant = static_cast<uint8_t>(en_passant.x + 1);
+  packed.ply = static_cast<uint16_t>(min(ply, 0xFFFF));
+}
+
+void unpack_pieces(const PackedPosition& packed, uint64_t pieces[2][6])
+{
+  memset(pieces, 0, sizeof(uint64_t) * 12);
+  uint64_t occupied = packed.occupied;
+  for (int i = 0; occupied; i++) {
+    const int square = pop_lowest_square(occupied);
+    const int piece_type = packed.pieces[i / 2] >> (i % 2 * 4) & 15;
+    pieces[piece_type < 6 ? WHITE : BLACK][piece_type % 6] |= 1ULL << square;
+  }
+}
+
+string packed_to_fen(const PackedPosition& packed)
+{
+  static const char piece_letters[] = "PNBRQKpnbrqk";
+  char board[64];
+  memset(board, 0, sizeof(board));
+  uint64_t occupied = packed.occupied;
+  for (int i = 0; occupied; i++) {
+    const int square = pop_lowest_square(occupied);
+    board[square] = piece_letters[packed.pieces[i / 2] >> (i % 2 * 4) & 15];
+  }
+
+  string fen;
+  for (int y = 7; y >= 0; y--) {
+    int empty = 0;
+    for (int x = 0; x < 8; x++) {
+      if (!board[y * 8 + x]) {
+        empty++;
+        continue;
+      }
+      if (empty)
+        fen += static_cast<char>('0' + empty);
+      empty = 0;
+      fen += board[y * 8 + x];
+    }
+    if (empty)
+      fen += static_cast<char>('0' + empty);
+    if (y)
+      fen += '/';
+  }
+  const bool whites_turn = packed.flags & PACKED_WHITES_TURN;
+  fen += whites_turn ? " w " : " b ";
+  static const char castling_letters[] = "KQkq";
+  const size_t castling_start = fen.size();
+  for (int right = 0; right < 4; right++) {
+    if (packed.flags & (PACKED_CASTLING << right))
+      fen += castling_letters[right];
+  }
+  if (fen.size() == castling_start)
+    fen += '-';
+  fen += ' ';
+  if (packed.en_passant) {
+    fen += static_cast<char>('a' + packed.en_passant - 1);
+    fen += whites_turn ? '6' : '3';
+  } else {
+    fen += '-';
+  }
+  fen += " 0 " + to_string(packed.ply / 2 + 1);
+  return fen;
+}
+
+bool TrainingDataWriter::open(const string& path)
+{
+  out.open(path, ios::binary | ios::trunc);
+  return out.is_open();
+}
+
+void TrainingDataWriter::write(const PackedPosition* records, size_t count)
+{
+  lock_guard<mutex> lock(out_mutex);
+  out.write(reinterpret_cast<const char*>(records), count * sizeof(PackedPosition));
+  written += count;
+}
+
+bool TrainingDataReader::open(const string& path)
+{
+  if (!file.open(path) || file.size() % sizeof(PackedPosition))
+    return false;
+  records = reinterpret_cast<const PackedPosition*>(file.data());
+  count = file.size() / sizeof(PackedPosition);
+  position = 0;
+  return true;
+}
+
+bool TrainingDataReader::next(PackedPosition& packed)
+{
+  if (position == count)
+    return false;
+  packed = records[position++];
+  return true;
+}
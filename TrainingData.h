@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+#include "Chess.h"
+#include "MappedFile.h"
+#include "Pgn.h"
+
+using namespace std;
+
+// Labelled positions for tuning and training, as fixed-width 32-byte
+// records written in the machine's byte order. A file is nothing but
+// records back to back.
+
+enum PackedFlags {
+  PACKED_WHITES_TURN = 1,
+  PACKED_CASTLING = 2,  // Four bits, one per CastlingRight in order
+  PACKED_ENDGAME = 32,  // BoardState::in_endgame()
+  PACKED_CAPTURE = 64,  // The move searched best is a capture
+};
+
+class PackedPosition {
+public:
+  uint64_t occupied;   // Bit y * 8 + x for every square with a piece on it
+  // A nibble per piece, in the order of the bits of occupied, low nibble
+  // first. Each holds the piece's PieceType from Zobrist.h.
+  uint8_t pieces[16];
+  int16_t score;       // Search score from white's point of view
+  uint8_t result;      // The GameResult of the game it was played in
+  uint8_t flags;       // PackedFlags
+  uint8_t en_passant;  // File of the en passant square plus one, or 0
+  uint8_t reserved;
+  uint16_t ply;        // Half-moves played since the start of the game
+};
+static_assert(sizeof(PackedPosition) == 32, "training records are 32 bytes");
+
+// Fills in everything but the result, which isn't known until the game ends
+void pack_position(const BoardState& state, int score, int ply, bool capture,
+  PackedPosition& packed);
+// The pieces as bitboards, indexed by colour and piece like
+// PositionBatch::pieces
+void unpack_pieces(const PackedPosition& packed, uint64_t pieces[2][6]);
+string packed_to_fen(const PackedPosition& packed);
+
+// Appends records to a file from any number of threads. Each call writes
+// its records in one piece, so a game's positions stay together.
+class TrainingDataWriter {
+public:
+  bool open(const string& path);
+  void write(const PackedPosition* records, size_t count);
+  uint64_t records_written() const { return written; }
+private:
+  mutex out_mutex;
+  ofstream out;
+  uint64_t written = 0;
+};
+
+// Reads a file of records, mapped into memory rather than copied. They can
+// be stepped through with next() or indexed directly, from any number of
+// threads.
+class TrainingDataReader {
+public:
+  bool open(const string& path);
+  size_t size() const { return count; }
+  const PackedPosition& operator[](size_t i) const { return records[i]; }
+  // The next record in the file, or false at the end
+  bool next(PackedPosition& packed);
+private:
+  MappedFile file;
+  const PackedPosition* records = nullptr;
+  size_t count = 0;
+  size_t position = 0;
+};
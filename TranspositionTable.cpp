@@ -1,57 +1,49 @@
 #include "TranspositionTable.h"
 
-TranspositionTable::TranspositionTable() {
-  rng.seed(11195303932578022943);
-  for (int i = 0; i < num_random_numbers; i++) {
-    random_numbers[i] = rng();
-  }
-}
-
-void TranspositionTable::add(uint64_t hash, int depth, int eval, TableEntryFlag flag)
-{
-  if (map.count(hash)) {
-    // already exists but we've recalculated => we've gone deeper, so replace
-    map.erase(hash);
-  }
-  map.emplace(hash, TableEntry(depth, eval, flag));
-}
-
-bool TranspositionTable::search(uint64_t hash, int depth, TableEntry **entry)
+TranspositionTable::TranspositionTable(size_t megabytes)
 {
-  auto result = map.find(hash);
-  if (result != map.end()) {
-    *entry = &result->second;
-    if ((*entry)->depth >= depth) {
-      return true;
-    }
-  }
-  return false;
+  resize(megabytes);
 }
 
-void TranspositionTable::clear()
+// Rounds down to a power of two number of slots, so a mask picks the slot
+void TranspositionTable::resize(size_t megabytes)
 {
-  map.clear();
+  size_t num_slots = 1;
+  while (num_slots * 2 * sizeof(TableSlot) <= megabytes * 1024 * 1024)
+    num_slots *= 2;
+  slots.reset(new TableSlot[num_slots]);
+  mask = num_slots - 1;
+  clear();
 }
 
-void TranspositionTable::zobrist_xor_piece(
-  uint64_t& hash, PieceType piece, int x_pos, int y_pos)
+void TranspositionTable::add(uint64_t hash, int depth, int eval, TableEntryFlag flag, uint8_t best_move)
 {
-  hash ^= random_numbers[piece * 64 + y_pos * 8 + x_pos];
+  const uint64_t data = static_cast<uint32_t>(eval) |
+    static_cast<uint64_t>(static_cast<uint8_t>(depth)) << 32 |
+    static_cast<uint64_t>(flag) << 40 |
+    static_cast<uint64_t>(best_move) << 48;
+  TableSlot& slot = slots[hash & mask];
+  slot.check.store(hash ^ data, memory_order_relaxed);
+  slot.data.store(data, memory_order_relaxed);
 }
 
-void TranspositionTable::zobrist_xor_player(uint64_t& hash)
+bool TranspositionTable::search(uint64_t hash, int depth, TableEntry& entry) const
 {
-  hash ^= random_numbers[64 * NUM_PIECE_TYPES + 1];
+  const TableSlot& slot = slots[hash & mask];
+  const uint64_t data = slot.data.load(memory_order_relaxed);
+  if ((slot.check.load(memory_order_relaxed) ^ data) != hash)
+    return false;
+  entry = TableEntry(static_cast<uint8_t>(data >> 32), static_cast<int32_t>(data),
+    static_cast<TableEntryFlag>(data >> 40 & 0xFF), static_cast<uint8_t>(data >> 48));
+  return entry.depth >= depth;
 }
 
-void TranspositionTable::zobrist_xor_castling_rights(
-  uint64_t& hash, CastlingRight castling_right)
-{
-  hash ^= random_numbers[64 * NUM_PIECE_TYPES + 1 + castling_right];
-}
-
-void TranspositionTable::zobrist_xor_en_passant(
-  uint64_t& hash, int en_passant_file)
+void TranspositionTable::clear()
 {
-  hash ^= random_numbers[64 * NUM_PIECE_TYPES + 1 + 4 + en_passant_file];
+  // An empty slot can only match a position whose hash is 0, no likelier
+  // than any other collision
+  for (size_t i = 0; i <= mask; i++) {
+    slots[i].check.store(0, memory_order_relaxed);
+    slots[i].data.store(0, memory_order_relaxed);
+  }
 }
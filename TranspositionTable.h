@@ -1,65 +1,57 @@
 #pragma once
 
-#include <unordered_map>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
-#include <random>
+#include <memory>
 using namespace std;
 
-enum PieceType {
-  WHITE_PAWN,
-  WHITE_KNIGHT,
-  WHITE_BISHOP,
-  WHITE_ROOK,
-  WHITE_QUEEN,
-  WHITE_KING,
-  BLACK_PAWN,
-  BLACK_KNIGHT,
-  BLACK_BISHOP,
-  BLACK_ROOK,
-  BLACK_QUEEN,
-  BLACK_KING,
-  NUM_PIECE_TYPES,
-};
-
-enum CastlingRight {
-  WHITE_KINGSIDE,
-  WHITE_QUEENSIDE,
-  BLACK_KINGSIDE,
-  BLACK_QUEENSIDE,
-};
-
 enum TableEntryFlag : uint8_t {
   FLAG_EXACT,
   FLAG_LOWER_BOUND,
   FLAG_UPPER_BOUND,
 };
 
+// Stored in place of a move index when a position was scored without a search
+constexpr uint8_t no_best_move = UINT8_MAX;
+
 class TableEntry {
 public:
-  TableEntry(int d, int e, TableEntryFlag f) {
+  TableEntry() {}
+  TableEntry(int d, int e, TableEntryFlag f, uint8_t m) {
     depth = d;
     eval = e;
     flag = f;
+    best_move = m;
   }
   int eval;
   uint8_t depth;
   TableEntryFlag flag;
+  // Index into the position's possible_moves
+  uint8_t best_move;
 };
 
-constexpr int num_random_numbers = 64 * NUM_PIECE_TYPES + 1 + 4 + 8;
+// An entry packed into one word, stored alongside the word XORed with its
+// hash. A slot torn by two threads writing at once fails the check and
+// reads as a miss, so searches can share the table without locking.
+class TableSlot {
+public:
+  atomic<uint64_t> check;
+  atomic<uint64_t> data;
+};
 
+// Fixed-size, always-replace table of search results, safe to share
+// between threads
 class TranspositionTable {
 public:
-  TranspositionTable();
-  void add(uint64_t hash, int depth, int eval, TableEntryFlag flag);
-  bool search(uint64_t hash, int depth, TableEntry **entry);
+  TranspositionTable(size_t megabytes = 64);
+  void resize(size_t megabytes);
+  void add(uint64_t hash, int depth, int eval, TableEntryFlag flag, uint8_t best_move);
+  // Fills in entry whenever the position is found, but only returns true
+  // if it was searched to at least depth
+  bool search(uint64_t hash, int depth, TableEntry& entry) const;
   void clear();
-  void zobrist_xor_piece(uint64_t& hash, PieceType piece, int x_pos, int y_pos);
-  void zobrist_xor_player(uint64_t& hash);
-  void zobrist_xor_castling_rights(uint64_t& hash, CastlingRight castling_right);
-  void zobrist_xor_en_passant(uint64_t& hash, int en_passant_file);
 private:
-  unordered_map<uint64_t, TableEntry> map;
-  linear_congruential_engine<std::uint64_t, 48271, 0, ULLONG_MAX> rng;
-  uint64_t random_numbers[num_random_numbers];
+  unique_ptr<TableSlot[]> slots;
+  uint64_t mask;
 };
@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "Attacks.h"
+#include "Endgame.h"
+#include "PieceSquareTables.h"
+#include "TrainingData.h"
+#include "Tuner.h"
+#include "Utils.h"
+
+// The weights, all in one array. Piece-square tables are indexed as in
+// PieceSquareTables.h, from white's side of the board; the king has one
+// for before the endgame and one for after. The king's material value is
+// left out, since both sides always have one.
+enum TunedWeight {
+  WEIGHT_MATERIAL = 0,
+  WEIGHT_PST = WEIGHT_MATERIAL + KING,
+  // The king's table before the endgame is WEIGHT_PST + KING * 64
+  WEIGHT_KING_EG_PST = WEIGHT_PST + (KING + 1) * 64,
+  WEIGHT_BISHOP_PAIR = WEIGHT_KING_EG_PST + 64,
+  WEIGHT_KING_SHELTER,
+  NUM_WEIGHTS,
+};
+
+// The most weights one position can use: a square for every piece and
+// the two bonuses for each side
+constexpr int max_features = 32 + 4;
+// Bounds on the fitted scaling constant, per centipawn
+constexpr double min_scale = 0.0001;
+constexpr double max_scale = 0.1;
+
+// Bonuses a side has, shifted left by twice its PieceColour
+enum TuningBonus {
+  BONUS_BISHOP_PAIR = 1,
+  BONUS_KING_SHELTER = 2,
+};
+
+class TuningPosition {
+public:
+  uint32_t record;
+  int16_t pawn_score; // Pawn structure, which isn't tuned
+  uint8_t result;     // White's score for the game: 0, 1 or 2 half points
+  uint8_t bonuses;    // TuningBonus
+};
+
+// A weight a position uses, counted for white or against
+class Feature {
+public:
+  int16_t weight;
+  int16_t sign;
+};
+
+// Worked out once, when the positions are loaded, since they depend on
+// more than one piece
+static uint8_t find_bonuses(const PackedPosition& packed, const uint64_t pieces[2][6])
+{
+  uint8_t bonuses = 0;
+  for (int colour = BLACK; colour <= WHITE; colour++) {
+    uint64_t bishops = pieces[colour][BISHOP];
+    bishops &= bishops - 1;
+    if (bishops && !(bishops & (bishops - 1)))
+      bonuses |= BONUS_BISHOP_PAIR << (colour * 2);
+    const int forwards = colour == WHITE ? 1 : -1;
+    uint64_t kings = pieces[colour][KING];
+    while (kings && !(packed.flags & PACKED_ENDGAME)) {
+      const int square = pop_lowest_square(kings);
+      const int x = square % 8, y = square / 8;
+      if (pieces[colour][PAWN] & (square_bit(x, y + forwards) | square_bit(x, y + 2 * forwards)))
+        bonuses |= BONUS_KING_SHELTER << (colour * 2);
+    }
+  }
+  return bonuses;
+}
+
+// Reads the pieces straight from the record, which is quicker than
+// unpacking them into bitboards. A piece's material value is counted in
+// with its square, as the piece-square values passed in already hold it.
+static int collect_features(const PackedPosition& packed, uint8_t bonuses, Feature* features)
+{
+  const int king_table = packed.flags & PACKED_ENDGAME ? WEIGHT_KING_EG_PST : WEIGHT_PST + KING * 64;
+  int count = 0;
+  uint64_t occupied = packed.occupied;
+  for (int i = 0; occupied; i++) {
+    const int square = pop_lowest_square(occupied);
+    const int piece_type = packed.pieces[i / 2] >> (i % 2 * 4) & 15;
+    const int piece = piece_type % 6;
+    const int16_t sign = piece_type < 6 ? 1 : -1;
+    // The tables read white's ranks from the top down
+    const int relative = piece_type < 6 ? square ^ 56 : square;
+    const int table = piece == KING ? king_table : WEIGHT_PST + piece * 64;
+    features[count++] = { static_cast<int16_t>(table + relative), sign };
+  }
+  for (int colour = BLACK; colour <= WHITE; colour++) {
+    const int16_t sign = colour == WHITE ? 1 : -1;
+    if (bonuses >> (colour * 2) & BONUS_BISHOP_PAIR)
+      features[count++] = { WEIGHT_BISHOP_PAIR, sign };
+    if (bonuses >> (colour * 2) & BONUS_KING_SHELTER)
+      features[count++] = { WEIGHT_KING_SHELTER, sign };
+  }
+  return count;
+}
+
+// Whether a specialised evaluator, rather than the weights, scores the
+// position
+static bool scored_as_endgame(const PackedPosition& packed)
+{
+  if (!(packed.flags & PACKED_ENDGAME))
+    return false;
+  uint64_t pieces[2][6];
+  unpack_pieces(packed, pieces);
+  Square board[8][8];
+  int material[2][6];
+  for (int square = 0; square < 64; square++)
+    board[square / 8][square % 8] = { NONE, BLACK };
+  for (int colour = BLACK; colour <= WHITE; colour++) {
+    for (int piece = PAWN; piece <= KING; piece++) {
+      material[colour][piece] = 0;
+      uint64_t squares = pieces[colour][piece];
+      while (squares) {
+        const int square = pop_lowest_square(squares);
+        material[colour][piece]++;
+        board[square / 8][square % 8] = { static_cast<Piece>(piece), static_cast<PieceColour>(colour) };
+      }
+    }
+  }
+  int score;
+  return evaluate_endgame(board, material, (packed.flags & PACKED_WHITES_TURN) != 0, score);
+}
+
+class Tuner {
+public:
+  Tuner(const TrainingDataReader& reader, int num_threads);
+  void load();
+  // Mean squared error of the positions under the weights, and its
+  // gradient if asked for
+  double error(const vector<double>& weights, double scale, vector<double>* gradient) const;
+  double fit_scale(const vector<double>& weights) const;
+  size_t size() const { return positions.size(); }
+
+  // How many times the positions use each weight
+  vector<uint64_t> uses;
+private:
+  double slice_error(const vector<double>& values, double scale, size_t begin, size_t end,
+    vector<double>* gradient) const;
+
+  const TrainingDataReader& reader;
+  const int num_threads;
+  vector<TuningPosition> positions;
+};
+
+Tuner::Tuner(const TrainingDataReader& reader, int num_threads)
+  : reader(reader)
+  , num_threads(max(1, num_threads))
+{
+}
+
+void Tuner::load()
+{
+  vector<vector<TuningPosition>> slices(num_threads);
+  vector<vector<uint64_t>> slice_uses(num_threads, vector<uint64_t>(NUM_WEIGHTS, 0));
+  vector<thread> workers;
+  for (int i = 0; i < num_threads; i++) {
+    workers.emplace_back([&, i] {
+      Feature features[max_features];
+      const size_t begin = reader.size() * i / num_threads;
+      const size_t end = reader.size() * (i + 1) / num_threads;
+      for (size_t r = begin; r < end; r++) {
+        const PackedPosition& packed = reader[r];
+        if (packed.result == RESULT_UNKNOWN || (packed.flags & PACKED_CAPTURE) ||
+            scored_as_endgame(packed))
+          continue;
+        uint64_t pieces[2][6];
+        unpack_pieces(packed, pieces);
+        const uint64_t pawns[2] = { pieces[BLACK][PAWN], pieces[WHITE][PAWN] };
+        const uint8_t result = packed.result == RESULT_WHITE_WIN ? 2 :
+          packed.result == RESULT_DRAW ? 1 : 0;
+        const uint8_t bonuses = find_bonuses(packed, pieces);
+        slices[i].push_back({ static_cast<uint32_t>(r),
+          static_cast<int16_t>(evaluate_pawn_structure(pawns)), result, bonuses });
+        const int count = collect_features(packed, bonuses, features);
+        for (int f = 0; f < count; f++)
+          slice_uses[i][features[f].weight]++;
+      }
+    });
+  }
+  for (thread& worker : workers)
+    worker.join();
+
+  uses.assign(NUM_WEIGHTS, 0);
+  for (int i = 0; i < num_threads; i++) {
+    positions.insert(positions.end(), slices[i].begin(), slices[i].end());
+    for (int w = 0; w < NUM_WEIGHTS; w++)
+      uses[w] += slice_uses[i][w];
+  }
+  for (int piece = PAWN; piece < KING; piece++) {
+    for (int square = 0; square < 64; square++)
+      uses[WEIGHT_MATERIAL + piece] += uses[WEIGHT_PST + piece * 64 + square];
+  }
+}
+
+double Tuner::slice_error(const vector<double>& values, double scale, size_t begin,
+  size_t end, vector<double>* gradient) const
+{
+  Feature features[max_features];
+  double total = 0;
+  for (size_t i = begin; i < end; i++) {
+    const TuningPosition& position = positions[i];
+    const int count = collect_features(reader[position.record], position.bonuses, features);
+    double evaluation = position.pawn_score;
+    for (int f = 0; f < count; f++)
+      evaluation += features[f].sign * values[features[f].weight];
+    const double predicted = 1 / (1 + exp(-scale * evaluation));
+    const double difference = predicted - position.result * 0.5;
+    total += difference * difference;
+    if (gradient) {
+      const double slope = 2 * difference * predicted * (1 - predicted) * scale;
+      for (int f = 0; f < count; f++)
+        (*gradient)[features[f].weight] += features[f].sign * slope;
+    }
+  }
+  return total;
+}
+
+double Tuner::error(const vector<double>& weights, double scale, vector<double>* gradient) const
+{
+  // Each thread takes a fixed slice and the slices are summed in order, so
+  // the result doesn't depend on which thread finishes first
+  vector<double> totals(num_threads);
+  vector<vector<double>> gradients(num_threads);
+  // Every square of a piece's table with its material value added, so a
+  // piece costs one weight rather than two
+  vector<double> values = weights;
+  for (int piece = PAWN; piece < KING; piece++) {
+    for (int square = 0; square < 64; square++)
+      values[WEIGHT_PST + piece * 64 + square] += weights[WEIGHT_MATERIAL + piece];
+  }
+  vector<thread> workers;
+  for (int i = 0; i < num_threads; i++) {
+    workers.emplace_back([&, i] {
+      if (gradient)
+        gradients[i].assign(NUM_WEIGHTS, 0);
+      totals[i] = slice_error(values, scale, size() * i / num_threads,
+        size() * (i + 1) / num_threads, gradient ? &gradients[i] : nullptr);
+    });
+  }
+  for (thread& worker : workers)
+    worker.join();
+
+  double total = 0;
+  if (gradient)
+    gradient->assign(NUM_WEIGHTS, 0);
+  for (int i = 0; i < num_threads; i++) {
+    total += totals[i];
+    if (gradient) {
+      for (int w = 0; w < NUM_WEIGHTS; w++)
+        (*gradient)[w] += gradients[i][w] / size();
+    }
+  }
+  // A material value moves every square of its piece's table with it
+  if (gradient) {
+    for (int piece = PAWN; piece < KING; piece++) {
+      for (int square = 0; square < 64; square++)
+        (*gradient)[WEIGHT_MATERIAL + piece] += (*gradient)[WEIGHT_PST + piece * 64 + square];
+    }
+  }
+  return total / size();
+}
+
+// The scale whose sigmoid best matches the results, by golden section
+// search on its logarithm
+double Tuner::fit_scale(const vector<double>& weights) const
+{
+  const double ratio = (sqrt(5.0) - 1) / 2;
+  double low = log(min_scale), high = log(max_scale);
+  double a = high - ratio * (high - low), b = low + ratio * (high - low);
+  double error_a = error(weights, exp(a), nullptr), error_b = error(weights, exp(b), nullptr);
+  for (int i = 0; i < 25; i++) {
+    if (error_a < error_b) {
+      high = b;
+      b = a;
+      error_b = error_a;
+      a = high - ratio * (high - low);
+      error_a = error(weights, exp(a), nullptr);
+    } else {
+      low = a;
+      a = b;
+      error_a = error_b;
+      b = low + ratio * (high - low);
+      error_b = error(weights, exp(b), nullptr);
+    }
+  }
+  return exp((low + high) / 2);
+}
+
+static void initial_weights(vector<double>& weights)
+{
+  weights.assign(NUM_WEIGHTS, 0);
+  static const int* const tables[] = {
+    pawn_pst, knight_pst, bishop_pst, rook_pst, queen_pst, king_mg_pst, king_eg_pst,
+  };
+  for (int piece = PAWN; piece < KING; piece++)
+    weights[WEIGHT_MATERIAL + piece] = piece_values[piece];
+  for (int table = 0; table < 7; table++) {
+    for (int square = 0; square < 64; square++)
+      weights[WEIGHT_PST + table * 64 + square] = tables[table][square];
+  }
+  weights[WEIGHT_BISHOP_PAIR] = bishop_pair_bonus;
+  weights[WEIGHT_KING_SHELTER] = king_shelter_bonus;
+}
+
+// Raising a piece's value and lowering its every square by as much changes
+// nothing, so each table's mean over the squares the piece can stand on is
+// moved into its value, and the tables stay centred on zero
+static void centre_tables(vector<double>& weights)
+{
+  for (int piece = PAWN; piece < KING; piece++) {
+    // Pawns never stand on the first or last rank
+    const int first = piece == PAWN ? 8 : 0, last = piece == PAWN ? 56 : 64;
+    double* table = &weights[WEIGHT_PST + piece * 64];
+    double mean = 0;
+    for (int square = first; square < last; square++)
+      mean += table[square] / (last - first);
+    mean = round(mean);
+    for (int square = first; square < last; square++)
+      table[square] -= mean;
+    weights[WEIGHT_MATERIAL + piece] += mean;
+  }
+}
+
+static void write_table(ofstream& out, const char* name, const double* table)
+{
+  out << "\nstatic const int " << name << "[] = {\n";
+  for (int y = 0; y < 8; y++) {
+    out << " ";
+    for (int x = 0; x < 8; x++)
+      out << setw(4) << lround(table[y * 8 + x]) << ",";
+    out << "\n";
+  }
+  out << "};\n";
+}
+
+static bool write_weights(const string& path, const vector<double>& weights,
+  const TunerSettings& settings, size_t num_positions)
+{
+  ofstream out(path);
+  if (!out.is_open())
+    return false;
+  out << "#pragma once\n\n";
+  out << "// Material, indexed by Piece\n";
+  out << "static const int piece_values[] = {";
+  for (int piece = PAWN; piece < KING; piece++)
+    out << " " << lround(weights[WEIGHT_MATERIAL + piece]) << ",";
+  out << " " << piece_values[KING] << " };\n";
+  out << "static const int bishop_pair_bonus = " << lround(weights[WEIGHT_BISHOP_PAIR]) << ";\n";
+  out << "// For a pawn one or two squares in front of its own king, before the endgame\n";
+  out << "static const int king_shelter_bonus = " << lround(weights[WEIGHT_KING_SHELTER]) << ";\n";
+  out << "\n// These tables were tuned on " << num_positions << " positions from " <<
+    settings.path << "\n";
+  static const char* const names[] = {
+    "pawn_pst", "knight_pst", "bishop_pst", "rook_pst", "queen_pst", "king_mg_pst", "king_eg_pst",
+  };
+  for (int table = 0; table < 7; table++)
+    write_table(out, names[table], &weights[WEIGHT_PST + table * 64]);
+  return out.good();
+}
+
+int run_tuner(const TunerSettings& settings)
+{
+  TrainingDataReader reader;
+  if (!reader.open(settings.path)) {
+    cout << "Failed to read positions from " << settings.path << "\n";
+    return 1;
+  }
+  Timer timer;
+  Tuner tuner(reader, settings.num_threads);
+  tuner.load();
+  if (!tuner.size()) {
+    cout << "No positions to tune on in " << settings.path << "\n";
+    return 1;
+  }
+  cout << "Tuning on " << tuner.size() << " of " << reader.size() << " positions, loaded in " <<
+    timer.elapsed() << " seconds\n";
+
+  vector<double> weights;
+  initial_weights(weights);
+  const double scale = tuner.fit_scale(weights);
+  cout << "Fitted scale " << scale << " per centipawn, error " <<
+    tuner.error(weights, scale, nullptr) << "\n";
+
+  // Adam, with the usual decay rates
+  const double beta1 = 0.9, beta2 = 0.999, epsilon = 1e-12;
+  vector<double> gradient(NUM_WEIGHTS), momentum(NUM_WEIGHTS, 0), velocity(NUM_WEIGHTS, 0);
+  int held = 0;
+  for (int w = 0; w < NUM_WEIGHTS; w++)
+    held += tuner.uses[w] < settings.min_uses;
+  if (held)
+    cout << "Holding " << held << " weights used fewer than " << settings.min_uses << " times\n";
+  double error = 0;
+  for (int epoch = 1; epoch <= settings.epochs; epoch++) {
+    error = tuner.error(weights, scale, &gradient);
+    for (int w = 0; w < NUM_WEIGHTS; w++) {
+      if (tuner.uses[w] < settings.min_uses)
+        continue;
+      momentum[w] = beta1 * momentum[w] + (1 - beta1) * gradient[w];
+      velocity[w] = beta2 * velocity[w] + (1 - beta2) * gradient[w] * gradient[w];
+      const double corrected_momentum = momentum[w] / (1 - pow(beta1, epoch));
+      const double corrected_velocity = velocity[w] / (1 - pow(beta2, epoch));
+      weights[w] -= settings.learning_rate * corrected_momentum / (sqrt(corrected_velocity) + epsilon);
+    }
+    if (epoch % 10 == 0 || epoch == settings.epochs) {
+      cout << "Epoch " << epoch << ": error " << error << " after " <<
+        timer.elapsed() << " seconds\n";
+    }
+  }
+  centre_tables(weights);
+  cout << "Tuned error " << tuner.error(weights, scale, nullptr) << ", material";
+  for (int piece = PAWN; piece < KING; piece++)
+    cout << " " << lround(weights[WEIGHT_MATERIAL + piece]);
+  cout << "\n";
+
+  if (!write_weights(settings.output, weights, settings, tuner.size())) {
+    cout << "Failed to write " << settings.output << "\n";
+    return 1;
+  }
+  cout << "Wrote tuned tables to " << settings.output << " in " << timer.elapsed() << " seconds\n";
+  return 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+class TunerSettings {
+public:
+  string path;                       // Positions written by self-play
+  string output = "TunedTables.h";   // Where the tuned tables are written
+  int epochs = 300;                  // Passes over every position
+  double learning_rate = 1.0;        // Largest step a weight takes, in centipawns
+  // Weights used fewer times than this keep their values, since Adam would
+  // otherwise take full steps on what little the positions say about them
+  uint64_t min_uses = 1000;
+  int num_threads = 1;
+};
+
+// Tunes the classical evaluation's weights to the results of the games the
+// positions were played in (Texel's method). The error is the mean squared
+// difference between each game's result and sigmoid(k * evaluation), with
+// k fitted first to the weights as they stand. Every epoch then takes a
+// step of Adam along the gradient of the error over all the positions at
+// once, shared out between num_threads threads.
+//
+// The weights tuned are the material values, the piece-square tables, the
+// king shelter and the bishop pair. Pawn structure is held fixed. Positions
+// whose best move was a capture are left out as not quiet, and those a
+// specialised endgame evaluator scores as not depending on the weights.
+//
+// The result is written as a replacement for PieceSquareTables.h. Returns
+// nonzero if the positions can't be read or the output can't be written.
+int run_tuner(const TunerSettings& settings);
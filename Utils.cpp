@@ -46,106 +46,104 @@ static bool is_number_coord(char c)
   return c >= '1' && c <= '8';
 }
 
-bool parse_move_string(const BoardState& state, const string str, const Move* &move)
+static Piece piece_from_letter(char c)
 {
-  Piece piece_to_move;
-  switch (str[0]) {
+  switch (c) {
   case 'N':
-    piece_to_move = KNIGHT;
-    break;
+    return KNIGHT;
   case 'B':
-    piece_to_move = BISHOP;
-    break;
+    return BISHOP;
   case 'R':
-    piece_to_move = ROOK;
-    break;
+    return ROOK;
   case 'Q':
-    piece_to_move = QUEEN;
-    break;
+    return QUEEN;
   case 'K':
-    piece_to_move = KING;
-    break;
-  case 'O':
-    if (str == "O-O") {
-      for (int i = 0; i < state.possible_moves.size(); i++) {
-        const Move *found_move = &state.possible_moves[i];
-        if (found_move->to.x == 6 && found_move->from.x == 4 &&
-          state.board[found_move->from.y][found_move->from.x].occupancy == KING) {
-          move = found_move;
-          return true;
-        }
-      }
-    }
-    else if (str == "O-O-O") {
-      for (int i = 0; i < state.possible_moves.size(); i++) {
-        const Move *found_move = &state.possible_moves[i];
-        if (found_move->to.x == 2 && found_move->from.x == 4 &&
-          state.board[found_move->from.y][found_move->from.x].occupancy == KING) {
-          move = found_move;
-          return true;
-        }
-      }
-    }
-    return false;
+    return KING;
   default:
-    if (is_letter_coord(str[0]))
-      piece_to_move = PAWN;
+    return NONE;
+  }
+}
+
+bool parse_san(const BoardState& state, const char* begin, const char* end, const Move* &move)
+{
+  // Check marks and annotations say nothing about which move it is
+  while (end > begin && (end[-1] == '+' || end[-1] == '#' || end[-1] == '!' || end[-1] == '?'))
+    end--;
+  const size_t length = end - begin;
+
+  if (begin < end && (begin[0] == 'O' || begin[0] == '0')) {
+    const char castle = begin[0];
+    int to_x;
+    if (length == 3 && begin[1] == '-' && begin[2] == castle)
+      to_x = 6;
+    else if (length == 5 && begin[1] == '-' && begin[2] == castle && begin[3] == '-' && begin[4] == castle)
+      to_x = 2;
     else
       return false;
-    break;
-  }
-  if (piece_to_move == PAWN) {
-    if (str[1] == 'x') {
-      if (!is_letter_coord(str[2]) || !is_number_coord(str[3]))
-        return false;
-      Coords dest = Coords(str[2] - 'a', str[3] - '1');
-      for (int i = 0; i < state.possible_moves.size(); i++) {
-        const Move *found_move = &state.possible_moves[i];
-        if (found_move->to == dest && found_move->from.x == str[0] - 'a' &&
-          state.board[found_move->from.y][found_move->from.x].occupancy == PAWN) {
-          move = found_move;
-          return true;
-        }
-      }
-    } else if (is_number_coord(str[1]) && str[2] == '\0') {
-      Coords dest = Coords(str[0] - 'a', str[1] - '1');
-      for (int i = 0; i < state.possible_moves.size(); i++) {
-        const Move *found_move = &state.possible_moves[i];
-        if (found_move->to == dest && found_move->from.x == dest.x &&
-          state.board[found_move->from.y][found_move->from.x].occupancy == PAWN) {
-          move = found_move;
-          return true;
-        }
+    for (const Move& candidate : state.possible_moves) {
+      if (candidate.from.x == 4 && candidate.to.x == to_x && candidate.to.y == candidate.from.y &&
+        state.board[candidate.from.y][candidate.from.x].occupancy == KING) {
+        move = &candidate;
+        return true;
       }
     }
     return false;
   }
-  int next_char_idx = 1;
-  char disambiguation_char = 0;
-  if ((is_letter_coord(str[1]) || is_number_coord(str[1])) &&
-    (is_letter_coord(str[2]) || str[2] == 'x'))
-    disambiguation_char = str[next_char_idx++];
-  if (str[next_char_idx] == 'x')
-    next_char_idx++;
-  if (is_letter_coord(str[next_char_idx]) &&
-    is_number_coord(str[next_char_idx + 1])) {
-    Coords dest = Coords(str[next_char_idx] - 'a', str[next_char_idx + 1] - '1');
-    for (int i = 0; i < state.possible_moves.size(); i++) {
-      const Move *found_move = &state.possible_moves[i];
-      if (found_move->to == dest && piece_to_move ==
-        state.board[found_move->from.y][found_move->from.x].occupancy) {
-        if (disambiguation_char &&
-          found_move->from.x != disambiguation_char - 'a' &&
-          found_move->from.y != disambiguation_char - '1')
-          continue;
-        move = found_move;
-        return true;
-      }
+
+  const char* p = begin;
+  Piece piece = p < end ? piece_from_letter(*p) : NONE;
+  if (piece == NONE)
+    piece = PAWN;
+  else
+    p++;
+
+  // Only promotion to a queen is ever generated, and is also assumed when
+  // a pawn reaches the last rank without one being given
+  if (piece == PAWN && end - p >= 3 && piece_from_letter(end[-1]) != NONE) {
+    if (end[-1] != 'Q')
+      return false;
+    end--;
+    if (end[-1] == '=')
+      end--;
+  }
+
+  if (end - p < 2 || !is_letter_coord(end[-2]) || !is_number_coord(end[-1]))
+    return false;
+  const Coords dest(end[-2] - 'a', end[-1] - '1');
+  end -= 2;
+
+  // Whatever comes between the piece and the destination narrows down
+  // where it came from
+  int from_x = -1, from_y = -1;
+  for (; p < end; p++) {
+    if (is_letter_coord(*p))
+      from_x = *p - 'a';
+    else if (is_number_coord(*p))
+      from_y = *p - '1';
+    else if (*p != 'x' && *p != '-')
+      return false;
+  }
+  // A pawn named without its file is pushed, not capturing
+  if (piece == PAWN && from_x < 0)
+    from_x = dest.x;
+
+  for (const Move& candidate : state.possible_moves) {
+    if (candidate.to == dest &&
+      state.board[candidate.from.y][candidate.from.x].occupancy == piece &&
+      (from_x < 0 || candidate.from.x == from_x) &&
+      (from_y < 0 || candidate.from.y == from_y)) {
+      move = &candidate;
+      return true;
     }
   }
   return false;
 }
 
+bool parse_move_string(const BoardState& state, const string str, const Move* &move)
+{
+  return parse_san(state, str.data(), str.data() + str.size(), move);
+}
+
 void print_board(BoardState& state)
 {
   for (int i = 7; i >= 0; i--) {
@@ -23,5 +23,9 @@ private:
 };
 
 void move_to_string(const BoardState *state, const Move* move, string& str);
+// Finds the legal move written in standard algebraic notation between begin
+// and end. Check marks, annotations, full or partial disambiguation and
+// "0-0" style castling are accepted.
+bool parse_san(const BoardState& state, const char* begin, const char* end, const Move* &move);
 bool parse_move_string(const BoardState& state, const string str, const Move* &move);
 void print_board(BoardState& state);